@@ -43,11 +43,11 @@ class aabb {
 
     bool hit(const ray& r, interval ray_t) const {
         const point3& ray_orig = r.origin();
-        const vec3&   ray_dir  = r.direction();
+        const vec3&   ray_inv  = r.inverse_direction();
 
         for (int axis = 0; axis < 3; axis++) {
             const interval& ax = axis_interval(axis);
-            const double adinv = 1.0 / ray_dir[axis];
+            const real adinv = ray_inv[axis];
 
             auto t0 = (ax.min - ray_orig[axis]) * adinv;
             auto t1 = (ax.max - ray_orig[axis]) * adinv;
@@ -66,6 +66,20 @@ class aabb {
         return true;
     }
     
+    point3 centroid() const {
+        return point3((x.min + x.max) / 2, (y.min + y.max) / 2, (z.min + z.max) / 2);
+    }
+
+    real surface_area() const {
+        // Returns the total area of the box faces, or zero for an empty box.
+        auto dx = x.size();
+        auto dy = y.size();
+        auto dz = z.size();
+        if (dx < 0 || dy < 0 || dz < 0)
+            return 0;
+        return 2 * (dx*dy + dy*dz + dz*dx);
+    }
+
     int longest_axis() const {
         // Returns the index of the longest axis of the bounding box.
 
@@ -82,7 +96,7 @@ class aabb {
       void pad_to_minimums() {
           // Adjust the AABB so that no side is narrower than some delta, padding if necessary.
 
-          double delta = 0.0001;
+          real delta = 0.0001;
           if (x.size() < delta) x = x.expand(delta);
           if (y.size() < delta) y = y.expand(delta);
           if (z.size() < delta) z = z.expand(delta);
@@ -92,4 +106,61 @@ class aabb {
 const aabb aabb::empty    = aabb(interval::empty,    interval::empty,    interval::empty);
 const aabb aabb::universe = aabb(interval::universe, interval::universe, interval::universe);
 
+inline aabb clip_to_box(const aabb& box, const aabb& region) {
+    // Returns the part of box inside region, or an empty box if the two do not overlap.
+    interval axes[3];
+    for (int axis = 0; axis < 3; axis++) {
+        auto lo = std::fmax(box.axis_interval(axis).min, region.axis_interval(axis).min);
+        auto hi = std::fmin(box.axis_interval(axis).max, region.axis_interval(axis).max);
+        if (lo > hi)
+            return aabb::empty;
+        axes[axis] = interval(lo, hi);
+    }
+    return aabb(axes[0], axes[1], axes[2]);
+}
+
+inline aabb clip_polygon_bounds(const point3* vertices, int count, const aabb& region) {
+    // Bounds of the part of a convex polygon of at most 8 vertices inside region, or an empty
+    // box if none of it is. The polygon is clipped against each of the six faces in turn.
+    point3 buffers[2][16];
+    std::copy(vertices, vertices + count, buffers[0]);
+    int current = 0;
+
+    for (int axis = 0; axis < 3 && count > 0; axis++) {
+        for (int side = 0; side < 2 && count > 0; side++) {
+            // Keep the points with sign * (p - plane) <= 0, that is inside this face.
+            auto plane = side == 0 ? region.axis_interval(axis).min : region.axis_interval(axis).max;
+            real sign = side == 0 ? -1 : 1;
+            const point3* in = buffers[current];
+            point3* out = buffers[1 - current];
+            int kept = 0;
+
+            for (int k = 0; k < count; k++) {
+                const auto& a = in[k];
+                const auto& b = in[(k + 1) % count];
+                auto da = sign * (a[axis] - plane);
+                auto db = sign * (b[axis] - plane);
+                if (da <= 0)
+                    out[kept++] = a;
+                if ((da < 0 && db > 0) || (da > 0 && db < 0)) {
+                    auto crossing = a + (da / (da - db)) * (b - a);
+                    crossing[axis] = plane;
+                    out[kept++] = crossing;
+                }
+            }
+
+            count = kept;
+            current = 1 - current;
+        }
+    }
+
+    if (count == 0)
+        return aabb::empty;
+
+    aabb bounds(buffers[current][0], buffers[current][0]);
+    for (int k = 1; k < count; k++)
+        bounds = aabb(bounds, aabb(buffers[current][k], buffers[current][k]));
+    return bounds;
+}
+
 #endif
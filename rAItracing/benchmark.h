@@ -0,0 +1,262 @@
+//
+//  benchmark.h
+//  rAItracing
+//
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "bvh.h"
+#include "camera.h"
+#include "grid.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "linear_bvh.h"
+#include "motion_bvh.h"
+#include "scene.h"
+#include "top_level_bvh.h"
+#include "triangle_mesh.h"
+#include "unbounded.h"
+#include "wide_bvh.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+const size_t benchmark_list_limit = 2000;  // Larger worlds skip the unaccelerated list
+const double benchmark_treelet_milliseconds = 200;  // Time budget of the treelet pass
+
+#if RT_FLOAT
+const std::string benchmark_precision = "float";
+const std::string benchmark_other_precision = "double";
+#else
+const std::string benchmark_precision = "double";
+const std::string benchmark_other_precision = "float";
+#endif
+
+inline std::vector<unsigned char> benchmark_run(
+    const std::string& label, camera cam, const std::function<shared_ptr<hittable>()>& build,
+    double* throughput = nullptr
+) {
+    // Builds one acceleration structure, renders through it and prints build time, render time
+    // and ray throughput. Returns the rendered image, and the throughput in Mrays/s if asked.
+    using clock = std::chrono::steady_clock;
+
+    auto build_start = clock::now();
+    auto world = build();
+    std::chrono::duration<double, std::milli> build_time = clock::now() - build_start;
+
+    cam.save_image = false;
+    auto render_start = clock::now();
+    cam.render(*world, [](int) {});
+    std::chrono::duration<double> render_time = clock::now() - render_start;
+
+    auto mrays_per_second = cam.rays_traced / render_time.count() / 1e6;
+
+    std::clog << '\r';
+    std::cout << "  " << std::left << std::setw(22) << label << std::right << std::fixed
+              << std::setw(10) << std::setprecision(2) << build_time.count() << " ms build"
+              << std::setw(9) << std::setprecision(3) << render_time.count() << " s render"
+              << std::setw(9) << std::setprecision(2) << mrays_per_second << " Mrays/s\n";
+
+    if (throughput)
+        *throughput = mrays_per_second;
+    return cam.image_buffer;
+}
+
+inline void benchmark_precision_error(
+    const std::string& name, int image_width, const std::vector<unsigned char>& image
+) {
+    // Saves this build's image of the scene as a PPM and, once a build of the other precision has
+    // saved its own, prints how far apart the two are in 8-bit color levels.
+    auto path = [&](const std::string& precision) {
+        return "benchmark_" + name + "_" + precision + ".ppm";
+    };
+
+    int image_height = int(image.size() / 3 / image_width);
+    std::ofstream out(path(benchmark_precision), std::ios::binary);
+    out << "P6\n" << image_width << ' ' << image_height << "\n255\n";
+    out.write(reinterpret_cast<const char*>(image.data()), std::streamsize(image.size()));
+    out.close();
+
+    std::ifstream in(path(benchmark_other_precision), std::ios::binary);
+    std::string magic;
+    int width = 0, height = 0, max_value = 0;
+    if (!(in >> magic >> width >> height >> max_value) || width != image_width || height != image_height) {
+        std::cout << "  (build with the other precision to compare image error)\n";
+        return;
+    }
+    in.get();
+
+    std::vector<unsigned char> other(image.size());
+    in.read(reinterpret_cast<char*>(other.data()), std::streamsize(other.size()));
+
+    double squared_error = 0;
+    int max_error = 0;
+    for (size_t k = 0; k < image.size(); k++) {
+        int error = std::abs(int(image[k]) - int(other[k]));
+        squared_error += double(error) * error;
+        max_error = std::max(max_error, error);
+    }
+
+    std::cout << "  image error vs " << benchmark_other_precision << " build: RMS "
+              << std::setprecision(3) << std::sqrt(squared_error / image.size())
+              << ", max " << max_error << " levels\n";
+}
+
+inline void benchmark_scene(
+    const std::string& name, const scene& s, int image_width = 200, int samples_per_pixel = 4
+) {
+    // Renders a reduced-size version of the scene with each acceleration structure in turn.
+    // Every run traces the same rays, so the image of one run stands for all of them.
+    auto cam = s.cam;
+    cam.image_width = std::min(cam.image_width, image_width);
+    cam.samples_per_pixel = samples_per_pixel;
+
+    // Unbounded objects are left out of every acceleration structure and tested beside it.
+    const auto& world = s.world;
+    auto split = split_unbounded(world);
+    const auto& bounded = split.bounded;
+    auto with_planes = [&](shared_ptr<hittable> accelerator) -> shared_ptr<hittable> {
+        if (split.unbounded.objects.empty())
+            return accelerator;
+        return make_shared<with_unbounded>(accelerator, split.unbounded);
+    };
+
+    std::cout << name << " (" << world.objects.size() << " objects";
+    if (!split.unbounded.objects.empty())
+        std::cout << ", " << split.unbounded.objects.size() << " unbounded";
+
+    size_t triangles = 0, mesh_bytes = 0;
+    for (const auto& object : world.objects) {
+        if (auto mesh = dynamic_cast<const triangle_mesh*>(object.get())) {
+            triangles += mesh->triangle_count();
+            mesh_bytes += mesh->memory_bytes();
+        }
+    }
+    if (triangles > 0)
+        std::cout << ", " << triangles << " triangles in " << std::setprecision(1) << std::fixed
+                  << mesh_bytes / 1048576.0 << " MB of meshes";
+    std::cout << ")\n";
+
+    if (world.objects.size() <= benchmark_list_limit)
+        benchmark_run("hittable_list", cam, [&] { return make_shared<hittable_list>(world); });
+
+    benchmark_run("bvh_node median", cam, [&] {
+        return with_planes(make_shared<bvh_node>(bounded));
+    });
+    benchmark_run("bvh_node sah", cam, [&] {
+        return with_planes(make_shared<bvh_node>(bounded, bvh_split::sah));
+    });
+    benchmark_run("linear_bvh median", cam, [&] {
+        return with_planes(make_shared<linear_bvh>(bounded, bvh_split::median));
+    });
+    double sah_throughput = 0, treelet_throughput = 0;
+    auto image = benchmark_run("linear_bvh sah", cam, [&] {
+        return with_planes(make_shared<linear_bvh>(bounded));
+    }, &sah_throughput);
+
+    bvh_treelet_stats treelets;
+    benchmark_run("linear_bvh treelets", cam, [&] {
+        bvh_build_options options;
+        options.treelet_milliseconds = benchmark_treelet_milliseconds;
+        auto bvh = make_shared<linear_bvh>(bounded, options);
+        treelets = bvh->treelet_stats();
+        return with_planes(bvh);
+    }, &treelet_throughput);
+    if (sah_throughput > 0) {
+        std::cout << "    " << std::setprecision(3) << treelets << ", "
+                  << std::showpos << 100 * (treelet_throughput / sah_throughput - 1) << std::noshowpos
+                  << "% rays/s\n";
+    }
+
+    benchmark_run("linear_bvh unpacked", cam, [&] {
+        bvh_build_options options;
+        options.pack_spheres = false;
+        return with_planes(make_shared<linear_bvh>(bounded, options));
+    });
+
+    benchmark_run("linear_bvh sbvh", cam, [&] {
+        bvh_build_options options;
+        options.spatial_splits = true;
+        return with_planes(make_shared<linear_bvh>(bounded, options));
+    });
+
+    auto single_rays = cam;
+    single_rays.packet_size = 1;
+    benchmark_run("linear_bvh no packets", single_rays, [&] {
+        return with_planes(make_shared<linear_bvh>(bounded));
+    });
+
+    auto wavefront = cam;
+    wavefront.wavefront = true;
+    benchmark_run("linear_bvh wavefront", wavefront, [&] {
+        return with_planes(make_shared<linear_bvh>(bounded));
+    });
+
+    benchmark_run("bvh4", cam, [&] { return with_planes(make_shared<bvh4>(bounded)); });
+    benchmark_run("bvh8", cam, [&] { return with_planes(make_shared<bvh8>(bounded)); });
+
+    benchmark_run("uniform_grid", cam, [&] { return with_planes(make_shared<uniform_grid>(bounded)); });
+
+    if (has_motion(bounded))
+        benchmark_run("motion_bvh", cam, [&] {
+            return with_planes(make_shared<motion_bvh>(bounded));
+        });
+
+    benchmark_precision_error(name, cam.image_width, image);
+}
+
+inline void benchmark_animation(
+    const std::string& name, const scene& s, int frames = 4, size_t moves_per_frame = 10,
+    int image_width = 200, int samples_per_pixel = 4
+) {
+    // Moves a few of the scene's instances each frame and brings a top-level BVH up to date,
+    // against rebuilding a linear_bvh over the same objects from scratch. The bottom-level trees
+    // inside the instances are reused either way.
+    auto cam = s.cam;
+    cam.image_width = std::min(cam.image_width, image_width);
+    cam.samples_per_pixel = samples_per_pixel;
+
+    std::vector<shared_ptr<instance>> instances;
+    for (const auto& object : s.world.objects) {
+        if (auto placed = std::dynamic_pointer_cast<instance>(object))
+            instances.push_back(placed);
+    }
+    if (instances.empty())
+        return;
+
+    std::cout << name << " animated (" << instances.size() << " instances, "
+              << std::min(moves_per_frame, instances.size()) << " moved per frame)\n";
+
+    auto top_level = make_shared<top_level_bvh>(s.world);
+    for (int frame = 1; frame <= frames; frame++) {
+        for (size_t k = 0; k < moves_per_frame && k < instances.size(); k++) {
+            auto& moved = instances[size_t(random_double(0, double(instances.size())))];
+            auto step = vec3(random_double(-0.5, 0.5), 0, random_double(-0.5, 0.5));
+            moved->set_transform(transform::translation(step) * moved->object_to_world());
+        }
+
+        auto update = top_level->update();
+
+        using clock = std::chrono::steady_clock;
+        auto rebuild_start = clock::now();
+        linear_bvh rebuilt(s.world);
+        std::chrono::duration<double, std::milli> rebuild_time = clock::now() - rebuild_start;
+
+        std::cout << "  frame " << frame << ": top level " << (update.rebuilt ? "rebuilt" : "refit")
+                  << " in " << std::setprecision(3) << update.milliseconds << " ms (SAH cost "
+                  << std::setprecision(2) << update.sah_cost << "), full linear_bvh build "
+                  << std::setprecision(3) << rebuild_time.count() << " ms\n";
+        benchmark_run("top_level_bvh", cam, [&] { return top_level; });
+    }
+}
+
+#endif
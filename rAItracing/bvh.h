@@ -7,6 +7,7 @@
 #define BVH_H
 
 #include "aabb.h"
+#include "bvh_build.h"
 #include "hittable.h"
 #include "hittable_list.h"
 
@@ -14,34 +15,33 @@
 
 class bvh_node : public hittable {
   public:
-    bvh_node(hittable_list list) : bvh_node(list.objects, 0, list.objects.size()) {
+    bvh_node(hittable_list list, bvh_split split = bvh_split::median)
+      : bvh_node(list.objects, 0, list.objects.size(), split) {
     }
 
-    bvh_node(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end) {
+    bvh_node(
+        std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end,
+        bvh_split split = bvh_split::median
+    ) {
         // Build the bounding box of the span of source objects.
         bbox = aabb::empty;
         for (size_t object_index=start; object_index < end; object_index++)
             bbox = aabb(bbox, objects[object_index]->bounding_box());
 
-        int axis = bbox.longest_axis();
-
-        auto comparator = (axis == 0) ? box_x_compare
-                        : (axis == 1) ? box_y_compare
-                                      : box_z_compare;
-
         size_t object_span = end - start;
 
+        leaf = object_span <= 2;
         if (object_span == 1) {
             left = right = objects[start];
         } else if (object_span == 2) {
             left = objects[start];
             right = objects[start+1];
         } else {
-            std::sort(std::begin(objects) + start, std::begin(objects) + end, comparator);
+            int axis;
+            auto mid = bvh_partition(split, objects, start, end, bbox, box_of, axis);
 
-            auto mid = start + object_span/2;
-            left = make_shared<bvh_node>(objects, start, mid);
-            right = make_shared<bvh_node>(objects, mid, end);
+            left = make_shared<bvh_node>(objects, start, mid, split);
+            right = make_shared<bvh_node>(objects, mid, end, split);
         }
 
     }
@@ -50,37 +50,52 @@ class bvh_node : public hittable {
         if (!bbox.hit(r, ray_t))
             return false;
 
-        bool hit_left = left->hit(r, ray_t, rec);
-        bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+        // Inner children are bvh_nodes, which leave the record to the primitives below them.
+        if (!leaf) {
+            bool hit_left = left->hit(r, ray_t, rec);
+            bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+            return hit_left || hit_right;
+        }
+
+        bool hit_left = hit_fresh(*left, r, ray_t, rec);
+        bool hit_right = hit_fresh(*right, r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
 
         return hit_left || hit_right;
     }
 
+    bvh_stats stats() const {
+        bvh_stats result;
+        accumulate_stats(result, 0);
+        result.finish(bbox);
+        return result;
+    }
+
     aabb bounding_box() const override { return bbox; }
 
   private:
     shared_ptr<hittable> left;
     shared_ptr<hittable> right;
     aabb bbox;
+    bool leaf;  // Whether the children are primitives rather than bvh_nodes
     
-    static bool box_compare(
-        const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis_index
-    ) {
-        auto a_axis_interval = a->bounding_box().axis_interval(axis_index);
-        auto b_axis_interval = b->bounding_box().axis_interval(axis_index);
-        return a_axis_interval.min < b_axis_interval.min;
+    static aabb box_of(const shared_ptr<hittable>& object) {
+        return object->bounding_box();
     }
 
-    static bool box_x_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-        return box_compare(a, b, 0);
-    }
+    void accumulate_stats(bvh_stats& stats, int depth) const {
+        stats.add_interior(bbox, depth);
 
-    static bool box_y_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-        return box_compare(a, b, 1);
-    }
+        // Children that are not bvh_nodes are single-primitive leaves. A node built over one
+        // object points both children at it, so count that object once.
+        for (const auto& child : {left, right}) {
+            if (auto node = std::dynamic_pointer_cast<bvh_node>(child))
+                node->accumulate_stats(stats, depth + 1);
+            else
+                stats.add_leaf(child->bounding_box(), 1, depth + 1);
 
-    static bool box_z_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-        return box_compare(a, b, 2);
+            if (left == right)
+                break;
+        }
     }
 };
 
@@ -0,0 +1,376 @@
+//
+//  bvh_build.h
+//  rAItracing
+//
+
+#ifndef BVH_BUILD_H
+#define BVH_BUILD_H
+
+#include "aabb.h"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+// How a BVH builder chooses where to split a node's primitives.
+enum class bvh_split {
+    median,  // Sort on the longest axis and split the primitive count in half
+    sah      // Binned surface area heuristic over the primitive centroids
+};
+
+const int    bvh_sah_bins          = 16;   // Centroid bins per axis for the SAH sweep
+const double bvh_traversal_cost    = 1.0;  // SAH cost of visiting an interior node
+const double bvh_intersection_cost = 1.0;  // SAH cost of testing one primitive
+
+const double bvh_spatial_split_overlap = 1e-5;  // Child overlap, relative to the root area,
+                                                // above which spatial splits are tried
+
+struct bvh_build_options {
+    bvh_split split         = bvh_split::sah;
+    int       max_leaf_size = 4;  // Most primitives stored in one leaf
+    int       thread_count  = 0;  // Build threads (0 = all hardware threads, 1 = serial)
+    bool      pack_spheres  = true;  // Store leaves made only of spheres as SIMD sphere packs
+    bool      spatial_splits  = false;  // Also split primitives between nodes (SBVH); serial
+    double    max_duplication = 0.5;    // Extra references spatial splits may add, per primitive
+    double    treelet_milliseconds = 0; // Time for treelet restructuring after the build (0 = none)
+};
+
+const int bvh_treelet_leaves = 7;  // Subtrees a treelet is restructured over
+const int bvh_treelet_passes = 3;  // Most restructuring passes over the whole tree
+
+const size_t bvh_parallel_build_threshold = 4096;  // Smaller spans are always built serially
+
+class bvh_stats {
+  // Tree quality metrics, used to compare builders on the same scene.
+  public:
+    size_t node_count      = 0;
+    size_t leaf_count      = 0;
+    size_t primitive_count = 0;  // Sum of leaf sizes
+    int    max_depth       = 0;
+    size_t min_leaf_size   = 0;
+    size_t max_leaf_size   = 0;
+    double sah_cost        = 0;  // Expected cost of a random ray hitting the root bounds
+
+    double average_leaf_size() const {
+        return leaf_count > 0 ? double(primitive_count) / leaf_count : 0;
+    }
+
+    void add_interior(const aabb& box, int depth) {
+        node_count++;
+        max_depth = std::max(max_depth, depth);
+        area_sum += bvh_traversal_cost * box.surface_area();
+    }
+
+    void add_leaf(const aabb& box, size_t size, int depth) {
+        node_count++;
+        min_leaf_size = (leaf_count == 0) ? size : std::min(min_leaf_size, size);
+        max_leaf_size = std::max(max_leaf_size, size);
+        leaf_count++;
+        primitive_count += size;
+        max_depth = std::max(max_depth, depth);
+        area_sum += bvh_intersection_cost * size * box.surface_area();
+    }
+
+    void finish(const aabb& root_box) {
+        auto root_area = root_box.surface_area();
+        sah_cost = root_area > 0 ? area_sum / root_area : 0;
+    }
+
+  private:
+    double area_sum = 0;
+};
+
+inline std::ostream& operator<<(std::ostream& out, const bvh_stats& stats) {
+    return out << "nodes " << stats.node_count
+               << ", leaves " << stats.leaf_count
+               << ", depth " << stats.max_depth
+               << ", leaf size " << stats.min_leaf_size << '/' << stats.average_leaf_size()
+               << '/' << stats.max_leaf_size << " (min/avg/max)"
+               << ", SAH cost " << stats.sah_cost;
+}
+
+struct bvh_treelet_stats {
+    // What treelet restructuring did to a tree.
+    double sah_before   = 0;
+    double sah_after    = 0;
+    size_t treelets     = 0;  // Treelets examined
+    size_t restructured = 0;  // Treelets given a cheaper topology
+    int    passes       = 0;
+    double milliseconds = 0;
+    bool   timed_out    = false;  // The time budget ended the passes
+};
+
+inline std::ostream& operator<<(std::ostream& out, const bvh_treelet_stats& stats) {
+    auto gain = stats.sah_before > 0 ? 100 * (1 - stats.sah_after / stats.sah_before) : 0;
+    return out << "SAH cost " << stats.sah_before << " -> " << stats.sah_after << " (" << gain
+               << "% lower), " << stats.restructured << " of " << stats.treelets
+               << " treelets restructured in " << stats.passes << " passes, "
+               << stats.milliseconds << " ms" << (stats.timed_out ? " (time budget reached)" : "");
+}
+
+class bvh_sah_binner {
+  // Sorts primitive boxes into centroid bins on all three axes and finds the bin boundary with
+  // the lowest surface area cost. Binners filled from disjoint ranges of primitives can be
+  // merged, which lets a builder bin a large node in parallel with the same result.
+  public:
+    explicit bvh_sah_binner(const aabb& centroid_bounds) {
+        for (int a = 0; a < 3; a++) {
+            const auto& extent = centroid_bounds.axis_interval(a);
+            c_min[a] = extent.min;
+            scale[a] = (extent.size() > 0) ? bvh_sah_bins / extent.size() : 0;
+        }
+    }
+
+    void add(const aabb& box) {
+        auto c = box.centroid();
+        for (int a = 0; a < 3; a++) {
+            auto& b = bins[a][bin_index(c, a)];
+            b.box = aabb(b.box, box);
+            b.count++;
+        }
+    }
+
+    void merge(const bvh_sah_binner& other) {
+        for (int a = 0; a < 3; a++) {
+            for (int b = 0; b < bvh_sah_bins; b++) {
+                bins[a][b].box = aabb(bins[a][b].box, other.bins[a][b].box);
+                bins[a][b].count += other.bins[a][b].count;
+            }
+        }
+    }
+
+    bool find_split(int& axis, int& boundary) const {
+        double cost;
+        return find_split(axis, boundary, cost);
+    }
+
+    bool find_split(int& axis, int& boundary, double& best_cost) const {
+        // Returns false when every centroid falls into one bin, so no boundary separates them.
+        // The cost is the children's area weighted by their primitive counts.
+        best_cost = infinity;
+        bool found = false;
+
+        for (int a = 0; a < 3; a++) {
+            if (scale[a] <= 0)
+                continue;
+
+            // Right-to-left pass for the area and count above each boundary.
+            double right_area[bvh_sah_bins];
+            size_t right_count[bvh_sah_bins];
+            aabb   right_box = aabb::empty;
+            size_t count = 0;
+            for (int b = bvh_sah_bins - 1; b > 0; b--) {
+                right_box = aabb(right_box, bins[a][b].box);
+                count += bins[a][b].count;
+                right_area[b] = right_box.surface_area();
+                right_count[b] = count;
+            }
+
+            aabb   left_box = aabb::empty;
+            size_t left_count = 0;
+            for (int b = 1; b < bvh_sah_bins; b++) {
+                left_box = aabb(left_box, bins[a][b-1].box);
+                left_count += bins[a][b-1].count;
+                if (left_count == 0 || right_count[b] == 0)
+                    continue;
+
+                auto cost = left_count * left_box.surface_area() + right_count[b] * right_area[b];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    axis = a;
+                    boundary = b;
+                    found = true;
+                }
+            }
+        }
+
+        return found;
+    }
+
+    bool goes_left(const aabb& box, int axis, int boundary) const {
+        return bin_index(box.centroid(), axis) < boundary;
+    }
+
+  private:
+    struct bin {
+        aabb   box = aabb::empty;
+        size_t count = 0;
+    };
+
+    bin    bins[3][bvh_sah_bins];
+    double c_min[3];
+    double scale[3];
+
+    int bin_index(const point3& c, int axis) const {
+        return std::min(bvh_sah_bins - 1, int((c[axis] - c_min[axis]) * scale[axis]));
+    }
+};
+
+class bvh_spatial_binner {
+  // Bins for spatial splits (Stich et al., "Spatial Splits in Bounding Volume Hierarchies").
+  // The bins divide the node's bounds rather than the centroids' bounds, and a primitive
+  // reference is clipped to every bin it overlaps, so a split plane can cut through primitives
+  // and the two children need not overlap. Each reference is counted where it enters and where
+  // it exits along the axis.
+  public:
+    explicit bvh_spatial_binner(const aabb& node_bounds) {
+        for (int a = 0; a < 3; a++) {
+            const auto& extent = node_bounds.axis_interval(a);
+            origin[a] = extent.min;
+            width[a] = extent.size() / bvh_sah_bins;
+        }
+    }
+
+    template <typename ClipOf>
+    void add(const aabb& box, uint32_t index, const ClipOf& clip_primitive) {
+        // clip_primitive(index, region) returns the bounds of the primitive inside region.
+        for (int a = 0; a < 3; a++) {
+            if (width[a] <= 0)
+                continue;
+
+            int first = bin_index(box.axis_interval(a).min, a);
+            int last = bin_index(box.axis_interval(a).max, a);
+            bins[a][first].entries++;
+            bins[a][last].exits++;
+            if (first == last) {
+                bins[a][first].box = aabb(bins[a][first].box, box);
+                continue;
+            }
+
+            for (int b = first; b <= last; b++) {
+                auto part = clip_primitive(index, clip_to_box(box, slab(a, b, b + 1, box)));
+                bins[a][b].box = aabb(bins[a][b].box, part);
+            }
+        }
+    }
+
+    bool find_split(int& axis, int& boundary, double& best_cost, size_t count) const {
+        // Like bvh_sah_binner::find_split, counting a reference on every side it reaches.
+        // Splits that leave either child with all count references are skipped.
+        best_cost = infinity;
+        bool found = false;
+
+        for (int a = 0; a < 3; a++) {
+            if (width[a] <= 0)
+                continue;
+
+            double right_area[bvh_sah_bins];
+            size_t right_count[bvh_sah_bins];
+            aabb   right_box = aabb::empty;
+            size_t exits = 0;
+            for (int b = bvh_sah_bins - 1; b > 0; b--) {
+                right_box = aabb(right_box, bins[a][b].box);
+                exits += bins[a][b].exits;
+                right_area[b] = right_box.surface_area();
+                right_count[b] = exits;
+            }
+
+            aabb   left_box = aabb::empty;
+            size_t entries = 0;
+            for (int b = 1; b < bvh_sah_bins; b++) {
+                left_box = aabb(left_box, bins[a][b-1].box);
+                entries += bins[a][b-1].entries;
+                if (entries == 0 || right_count[b] == 0 || entries >= count || right_count[b] >= count)
+                    continue;
+
+                auto cost = entries * left_box.surface_area() + right_count[b] * right_area[b];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    axis = a;
+                    boundary = b;
+                    found = true;
+                }
+            }
+        }
+
+        return found;
+    }
+
+    int bin_index(real x, int axis) const {
+        return std::clamp(int((x - origin[axis]) / width[axis]), 0, bvh_sah_bins - 1);
+    }
+
+    real plane(int axis, int boundary) const { return origin[axis] + boundary * width[axis]; }
+
+    aabb slab(int axis, int first, int last, const aabb& box) const {
+        // The part of the universe between bin boundaries first and last along axis, with the
+        // outermost bins left open so that nothing beyond the node's bounds is cut off.
+        interval axes[3] = {box.x, box.y, box.z};
+        axes[axis] = interval(first == 0 ? -infinity : plane(axis, first),
+                              last == bvh_sah_bins ? infinity : plane(axis, last));
+        return aabb(axes[0], axes[1], axes[2]);
+    }
+
+  private:
+    struct bin {
+        aabb   box = aabb::empty;
+        size_t entries = 0;  // References whose bounds start in this bin
+        size_t exits = 0;    // References whose bounds end in this bin
+    };
+
+    bin    bins[3][bvh_sah_bins];
+    double origin[3];
+    double width[3];
+};
+
+template <typename Item, typename BoxOf>
+aabb bvh_centroid_bounds(const std::vector<Item>& items, size_t start, size_t end, const BoxOf& box_of) {
+    aabb bounds = aabb::empty;
+    for (size_t i = start; i < end; i++) {
+        auto c = box_of(items[i]).centroid();
+        bounds = aabb(bounds, aabb(c, c));
+    }
+    return bounds;
+}
+
+template <typename Item, typename BoxOf>
+size_t bvh_median_partition(
+    std::vector<Item>& items, size_t start, size_t end, int axis, const BoxOf& box_of
+) {
+    // Splits at the median of the box minimums on axis without sorting the span. Items that tie
+    // with the median may land on either side, in an order that depends on the standard library,
+    // so with ties the tree can differ from a full sort's; both halves are valid median splits.
+    auto mid = start + (end - start)/2;
+    std::nth_element(items.begin() + start, items.begin() + mid, items.begin() + end,
+        [&](const Item& a, const Item& b) {
+            return box_of(a).axis_interval(axis).min < box_of(b).axis_interval(axis).min;
+        });
+    return mid;
+}
+
+template <typename Item, typename BoxOf>
+size_t bvh_sah_partition(
+    std::vector<Item>& items, size_t start, size_t end, const bvh_sah_binner& binner,
+    int axis, int boundary, const BoxOf& box_of
+) {
+    auto second = std::partition(items.begin() + start, items.begin() + end, [&](const Item& item) {
+        return binner.goes_left(box_of(item), axis, boundary);
+    });
+    return size_t(second - items.begin());
+}
+
+template <typename Item, typename BoxOf>
+size_t bvh_partition(
+    bvh_split split, std::vector<Item>& items, size_t start, size_t end, const aabb& bounds,
+    const BoxOf& box_of, int& axis
+) {
+    // Reorders items[start,end) into two non-empty halves and returns the index where the second
+    // one begins. The chosen split axis is written to `axis`.
+
+    axis = bounds.longest_axis();
+    if (split == bvh_split::median)
+        return bvh_median_partition(items, start, end, axis, box_of);
+
+    bvh_sah_binner binner(bvh_centroid_bounds(items, start, end, box_of));
+    for (size_t i = start; i < end; i++)
+        binner.add(box_of(items[i]));
+
+    // All centroids coincide, so no plane separates them; fall back to an even split.
+    int boundary;
+    if (!binner.find_split(axis, boundary))
+        return bvh_median_partition(items, start, end, axis, box_of);
+
+    return bvh_sah_partition(items, start, end, binner, axis, boundary, box_of);
+}
+
+#endif
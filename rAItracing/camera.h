@@ -9,8 +9,32 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "grid.h"
 #include "hittable.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
 #include "material.h"
+#include "material_table.h"
+#include "motion_bvh.h"
+#include "ray_packet.h"
+#include "thread_pool.h"
+#include "unbounded.h"
+#include "wavefront.h"
+
+// Acceleration structure a camera builds over a large world.
+enum class accelerator_choice {
+    automatic,  // A grid for worlds that suit one, otherwise a BVH
+    bvh,        // A BVH, with interpolated bounds if objects move
+    grid        // A uniform grid
+};
 
 class camera {
   public:
@@ -28,56 +52,68 @@ class camera {
     double defocus_angle = 0;  // Variation angle of rays through each pixel
     double focus_dist = 10;    // Distance from camera lookfrom point to plane of perfect focus
 
+    int    thread_count = 0;     // Render threads (0 = all hardware threads, 1 = serial)
+    int    tile_size    = 16;    // Edge length in pixels of a square render tile
+    unsigned int seed   = 0;     // Base seed of the per-sample random sequences
+    size_t bvh_threshold = 8;    // Worlds with at least this many objects render through a BVH
+    bool   save_image   = true;  // Write the image to stdout (PPM) and user_image.jpg
+    int    packet_size  = 8;     // Camera rays traced together as a packet (1 = one at a time)
+    bool   wavefront    = false; // Trace paths a bounce at a time in batches instead of recursively
+    accelerator_choice accelerator = accelerator_choice::automatic;  // Structure over large worlds
 
     std::vector<unsigned char> image_buffer;
+    uint64_t rays_traced = 0;    // Rays traced by the last render, camera and scattered
 
     void render(const hittable& world, std::function<void(int)> update_progress) {
         initialize();
 
-        std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
-        
         image_buffer.resize(image_width * image_height * 3);
+        rays_traced = 0;
 
-        for (int j = 0; j < image_height; j++) {
-            std::clog << "\rScanlines remaining: " << (image_height - j) << ' ' << std::flush;
-            std::clog << "\rRendering progress: " << (j / image_height * 100) << "%" << ' ' << std::flush;
-            for (int i = 0; i < image_width; i++) {
-                std::clog << "\rScanitems remaining: " << (image_width - i) << ' ' << std::flush;
-                auto rendering_progress = static_cast<double>(j) / image_height * 100 + static_cast<double>(i) / image_width / image_height * 100;
-                std::clog << "\rRendering progress: " << rendering_progress << "%" << ' ' << std::flush;
-                
-                color pixel_color(0,0,0);
-                for (int sample = 0; sample < samples_per_pixel; sample++) {
-                    ray r = get_ray(i, j);
-                    pixel_color += ray_color(r, max_depth, world);
-                }
-                write_color(std::cout, pixel_samples_scale * pixel_color);
-                
-                // Apply a linear to gamma transform for gamma 2
-                auto r = linear_to_gamma(pixel_samples_scale*pixel_color.x());
-                auto g = linear_to_gamma(pixel_samples_scale*pixel_color.y());
-                auto b = linear_to_gamma(pixel_samples_scale*pixel_color.z());
-                
-                static const interval intensity(0.000, 0.999);
-                image_buffer[3 * (j * image_width + i) + 0] = static_cast<unsigned char>(256 * intensity.clamp(r));
-                image_buffer[3 * (j * image_width + i) + 1] = static_cast<unsigned char>(256 * intensity.clamp(g));
-                image_buffer[3 * (j * image_width + i) + 2] = static_cast<unsigned char>(256 * intensity.clamp(b));
-
-                
-                update_progress(rendering_progress);
-                // write_color(std::cout, pixel_color);
+        int threads = (thread_count > 0) ? thread_count : thread_pool::hardware_threads();
+        if (threads <= 1)
+            render_scanlines(world, update_progress);
+        else
+            render_tiles(world, threads, update_progress);
+
+        if (save_image) {
+            std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+            for (size_t k = 0; k < image_buffer.size(); k += 3) {
+                std::cout << int(image_buffer[k]) << ' ' << int(image_buffer[k+1]) << ' '
+                          << int(image_buffer[k+2]) << '\n';
             }
-            
+
+            stbi_write_jpg("user_image.jpg", image_width, image_height, 3, image_buffer.data(), 100);
         }
-        
-        stbi_write_jpg("user_image.jpg", image_width, image_height, 3, image_buffer.data(), 100);
 
         std::clog << "\rDone.                 \n";
     }
 
+    void render(const hittable_list& world, std::function<void(int)> update_progress) {
+        // Flat object lists are searched linearly for every ray, so larger ones get a BVH or a
+        // grid first. A BVH's bounds follow the objects through the shutter interval if any of
+        // them move. Unbounded objects such as planes stay outside either structure.
+        if (world.objects.size() < bvh_threshold) {
+            render(static_cast<const hittable&>(world), update_progress);
+            return;
+        }
+
+        auto split = split_unbounded(world);
+        bool moving = has_motion(split.bounded);
+        bool grid = accelerator == accelerator_choice::grid
+                 || (accelerator == accelerator_choice::automatic && !moving && uniform_grid::suits(split.bounded));
+
+        if (grid)
+            render_through<uniform_grid>(split, "Grid", update_progress);
+        else if (moving)
+            render_through<motion_bvh>(split, "Motion BVH", update_progress);
+        else
+            render_through<linear_bvh>(split, "BVH", update_progress);
+    }
+
   private:
     int    image_height;   // Rendered image height
-    double pixel_samples_scale;  // Color scale factor for a sum of pixel samples
+    real   pixel_samples_scale;  // Color scale factor for a sum of pixel samples
     point3 center;         // Camera center
     point3 pixel00_loc;    // Location of pixel 0, 0
     vec3   pixel_delta_u;  // Offset to pixel to the right
@@ -86,6 +122,247 @@ class camera {
     vec3   defocus_disk_u;       // Defocus disk horizontal radius
     vec3   defocus_disk_v;       // Defocus disk vertical radius
 
+    template <typename Accelerator>
+    void render_through(
+        const unbounded_split& world, const char* name, const std::function<void(int)>& update_progress
+    ) {
+        auto build_start = std::chrono::steady_clock::now();
+        auto accelerator = make_shared<Accelerator>(world.bounded);
+        std::chrono::duration<double, std::milli> build_time = std::chrono::steady_clock::now() - build_start;
+
+        std::clog << name << " over " << world.bounded.objects.size() << " objects built in "
+                  << build_time.count() << " ms: " << accelerator->stats() << '\n';
+        if (world.unbounded.objects.empty()) {
+            render(*accelerator, update_progress);
+            return;
+        }
+
+        std::clog << world.unbounded.objects.size() << " unbounded objects tested apart\n";
+        render(with_unbounded(accelerator, world.unbounded), update_progress);
+    }
+
+    void render_scanlines(const hittable& world, const std::function<void(int)>& update_progress) {
+        for (int j = 0; j < image_height; j++) {
+            std::clog << "\rScanlines remaining: " << (image_height - j) << ' ' << std::flush;
+            rays_traced += render_row(world, 0, image_width, j);
+
+            update_progress(int(100.0 * (j + 1) / image_height));
+        }
+    }
+
+    void render_tiles(
+        const hittable& world, int threads, const std::function<void(int)>& update_progress
+    ) {
+        // Split the image into square tiles and let the pool's workers steal them from each
+        // other. Every pixel is seeded on its own, so the result matches render_scanlines.
+
+        struct tile { int x0, y0, x1, y1; };
+
+        auto size = std::max(tile_size, 1);
+        std::vector<tile> tiles;
+        for (int y = 0; y < image_height; y += size)
+            for (int x = 0; x < image_width; x += size)
+                tiles.push_back({x, y, std::min(x + size, image_width), std::min(y + size, image_height)});
+
+        std::atomic<long> pixels_done(0);
+        std::atomic<uint64_t> ray_count(0);
+        std::mutex progress_mutex;
+        auto pixel_count = long(image_width) * image_height;
+
+        thread_pool pool(threads);
+        pool.parallel_for(tiles.size(), [&](size_t index) {
+            const auto& t = tiles[index];
+            uint64_t tile_rays = 0;
+            for (int j = t.y0; j < t.y1; j++)
+                tile_rays += render_row(world, t.x0, t.x1, j);
+
+            ray_count += tile_rays;
+            auto done = pixels_done += long(t.x1 - t.x0) * (t.y1 - t.y0);
+            auto progress = int(100.0 * done / pixel_count);
+
+            std::lock_guard<std::mutex> lock(progress_mutex);
+            std::clog << "\rRendering progress: " << progress << "%" << ' ' << std::flush;
+            update_progress(progress);
+        });
+
+        rays_traced = ray_count;
+    }
+
+    uint64_t render_pixel(const hittable& world, int i, int j) {
+        // Every sample restarts the random sequence from (seed, pixel, sample), so a pixel comes
+        // out the same no matter which thread renders it, and any sample can be replayed alone.
+        auto pixel_index = uint64_t(j) * image_width + i;
+
+        uint64_t ray_count = 0;
+        color pixel_color(0,0,0);
+        for (int sample = 0; sample < samples_per_pixel; sample++) {
+            seed_random(mix_bits((uint64_t(seed) << 32) | uint32_t(sample)), pixel_index);
+            ray r = get_ray(i, j);
+            pixel_color += ray_color(r, max_depth, world, ray_count);
+        }
+
+        write_pixel(i, j, pixel_color);
+        return ray_count;
+    }
+
+    uint64_t render_row(const hittable& world, int i0, int i1, int j) {
+        // Renders pixels [i0,i1) of row j. With packets enabled, the camera rays of consecutive
+        // samples (of one pixel, then of its neighbors) are traced together; every ray continues
+        // on its own after the first hit, since scattered rays are no longer coherent.
+        if (wavefront)
+            return render_row_wavefront(world, i0, i1, j);
+
+        if (packet_size <= 1 || max_depth <= 0) {
+            uint64_t ray_count = 0;
+            for (int i = i0; i < i1; i++)
+                ray_count += render_pixel(world, i, j);
+            return ray_count;
+        }
+
+        int n = std::min(packet_size, max_ray_packet);
+        ray        rays[max_ray_packet];
+        pcg32      generators[max_ray_packet];  // Random state after each camera ray was made
+        int        pixels[max_ray_packet];
+        hit_record recs[max_ray_packet];
+        bool       hits[max_ray_packet];
+
+        std::vector<color> pixel_colors(i1 - i0, color(0,0,0));
+        auto samples = long(i1 - i0) * samples_per_pixel;
+        uint64_t ray_count = 0;
+
+        for (long first = 0; first < samples; first += n) {
+            int count = int(std::min<long>(n, samples - first));
+            for (int k = 0; k < count; k++) {
+                auto i = i0 + int((first + k) / samples_per_pixel);
+                auto sample = int((first + k) % samples_per_pixel);
+                seed_random(mix_bits((uint64_t(seed) << 32) | uint32_t(sample)), uint64_t(j) * image_width + i);
+                rays[k] = get_ray(i, j);
+                generators[k] = random_generator();
+                pixels[k] = i - i0;
+            }
+
+            world.hit_packet(rays, count, interval(ray_epsilon, infinity), recs, hits);
+            ray_count += count;
+
+            // Shade in sample order, so each pixel sums its samples exactly as render_pixel does.
+            for (int k = 0; k < count; k++) {
+                random_generator() = generators[k];
+                if (hits[k])
+                    recs[k].finalize(rays[k]);
+                pixel_colors[pixels[k]] += hits[k] ? shade(rays[k], recs[k], max_depth, world, ray_count)
+                                                   : background;
+            }
+        }
+
+        for (int i = i0; i < i1; i++)
+            write_pixel(i, j, pixel_colors[i - i0]);
+        return ray_count;
+    }
+
+    uint64_t render_row_wavefront(const hittable& world, int i0, int i1, int j) {
+        // Iterative version of ray_color over batches of paths. Every bounce runs two stages
+        // over the whole batch: extend finds the next hit of each active path and shade adds
+        // its emission, scatters it and queues the paths that continue. Each path restores its
+        // own random sequence, so it draws exactly the numbers the recursive integrator would.
+        std::vector<color> pixel_colors(i1 - i0, color(0,0,0));
+        auto samples = long(i1 - i0) * samples_per_pixel;
+        uint64_t ray_count = 0;
+
+        wavefront_paths paths;
+        for (long first = 0; first < samples; first += long(wavefront_batch_size)) {
+            auto count = size_t(std::min<long>(long(wavefront_batch_size), samples - first));
+            paths.reset(count);
+
+            // Generate: camera rays in pixel, then sample order.
+            for (size_t k = 0; k < count; k++) {
+                auto i = i0 + int((first + k) / samples_per_pixel);
+                auto sample = int((first + k) % samples_per_pixel);
+                seed_random(mix_bits((uint64_t(seed) << 32) | uint32_t(sample)), uint64_t(j) * image_width + i);
+                paths.rays[k] = get_ray(i, j);
+                paths.generators[k] = random_generator();
+            }
+
+            for (int depth = max_depth; depth > 0 && !paths.active.empty(); depth--) {
+                if (depth == max_depth && packet_size > 1)
+                    extend_packets(world, paths);
+                else
+                    extend(world, paths);
+                ray_count += paths.active.size();
+
+                shade_paths(paths);
+                std::swap(paths.active, paths.next);
+            }
+
+            for (size_t k = 0; k < count; k++)
+                pixel_colors[(first + k) / samples_per_pixel] += paths.radiance[k];
+        }
+
+        for (int i = i0; i < i1; i++)
+            write_pixel(i, j, pixel_colors[i - i0]);
+        return ray_count;
+    }
+
+    void extend(const hittable& world, wavefront_paths& paths) const {
+        for (auto id : paths.active) {
+            random_generator() = paths.generators[id];
+            paths.hits[id] = world.hit(paths.rays[id], interval(ray_epsilon, infinity), paths.recs[id]);
+            paths.generators[id] = random_generator();
+        }
+    }
+
+    void extend_packets(const hittable& world, wavefront_paths& paths) const {
+        // Camera rays are coherent, and before the first bounce the active queue is simply
+        // 0..count-1, so consecutive paths go through hit_packet together.
+        auto count = paths.active.size();
+        auto n = size_t(std::min(packet_size, max_ray_packet));
+        bool hits[max_ray_packet];
+
+        for (size_t first = 0; first < count; first += n) {
+            auto batch = int(std::min(n, count - first));
+            world.hit_packet(&paths.rays[first], batch, interval(ray_epsilon, infinity), &paths.recs[first], hits);
+            for (int k = 0; k < batch; k++)
+                paths.hits[first + k] = hits[k];
+        }
+    }
+
+    void shade_paths(wavefront_paths& paths) const {
+        paths.next.clear();
+        for (auto id : paths.active) {
+            if (!paths.hits[id]) {
+                paths.radiance[id] += paths.throughput[id] * background;
+                continue;
+            }
+
+            random_generator() = paths.generators[id];
+            auto& rec = paths.recs[id];
+            rec.finalize(paths.rays[id]);
+            const auto& entry = global_materials()[rec.material_id];
+            if (entry.emits)
+                paths.radiance[id] += paths.throughput[id] * entry.mat->emitted(rec.u, rec.v, rec.p);
+
+            ray scattered;
+            color attenuation;
+            if (entry.scatters && entry.mat->scatter(paths.rays[id], rec, attenuation, scattered)) {
+                paths.throughput[id] = paths.throughput[id] * attenuation;
+                paths.rays[id] = scattered;
+                paths.next.push_back(id);
+            }
+            paths.generators[id] = random_generator();
+        }
+    }
+
+    void write_pixel(int i, int j, const color& pixel_color) {
+        // Apply a linear to gamma transform for gamma 2
+        auto r = linear_to_gamma(pixel_samples_scale*pixel_color.x());
+        auto g = linear_to_gamma(pixel_samples_scale*pixel_color.y());
+        auto b = linear_to_gamma(pixel_samples_scale*pixel_color.z());
+
+        static const interval intensity(0.000, 0.999);
+        image_buffer[3 * (j * image_width + i) + 0] = static_cast<unsigned char>(256 * intensity.clamp(r));
+        image_buffer[3 * (j * image_width + i) + 1] = static_cast<unsigned char>(256 * intensity.clamp(g));
+        image_buffer[3 * (j * image_width + i) + 2] = static_cast<unsigned char>(256 * intensity.clamp(b));
+    }
+
     void initialize() {
         image_height = int(image_width / aspect_ratio);
         image_height = (image_height < 1) ? 1 : image_height;
@@ -150,24 +427,36 @@ class camera {
         return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
     }
     
-    color ray_color(const ray& r, int depth, const hittable& world) const {
+    color ray_color(const ray& r, int depth, const hittable& world, uint64_t& ray_count) const {
         // If we've exceeded the ray bounce limit, no more light is gathered.
         if (depth <= 0)
             return color(0,0,0);
 
+        ray_count++;
+
         hit_record rec;
         // If the ray hits nothing, return the background color.
-        if (!world.hit(r, interval(0.001, infinity), rec))
+        if (!world.hit(r, interval(ray_epsilon, infinity), rec))
             return background;
 
+        rec.finalize(r);
+        return shade(r, rec, depth, world, ray_count);
+    }
+
+    color shade(
+        const ray& r, const hit_record& rec, int depth, const hittable& world, uint64_t& ray_count
+    ) const {
+        // Light leaving the hit point of r back along the ray: emission plus scattered light.
+        // Materials that cannot emit or scatter skip the corresponding virtual call.
+        const auto& entry = global_materials()[rec.material_id];
         ray scattered;
         color attenuation;
-        color color_from_emission = rec.mat->emitted(rec.u, rec.v, rec.p);
+        color color_from_emission = entry.emits ? entry.mat->emitted(rec.u, rec.v, rec.p) : color(0,0,0);
 
-        if (!rec.mat->scatter(r, rec, attenuation, scattered))
+        if (!entry.scatters || !entry.mat->scatter(r, rec, attenuation, scattered))
             return color_from_emission;
 
-        color color_from_scatter = attenuation * ray_color(scattered, depth-1, world);
+        color color_from_scatter = attenuation * ray_color(scattered, depth-1, world, ray_count);
 
         return color_from_emission + color_from_scatter;
     }
@@ -0,0 +1,268 @@
+//
+//  grid.h
+//  rAItracing
+//
+
+#ifndef GRID_H
+#define GRID_H
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include "primitive_arrays.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+const double grid_density        = 2.0;  // Cells per object of a uniform grid
+const int    grid_max_resolution = 256;  // Most cells along one axis
+
+struct grid_stats {
+    int    resolution[3] = {0, 0, 0};
+    size_t cell_count    = 0;
+    size_t empty_cells   = 0;
+    size_t references    = 0;  // Object references over all cells
+    size_t object_count  = 0;
+};
+
+inline std::ostream& operator<<(std::ostream& out, const grid_stats& stats) {
+    auto empty = stats.cell_count > 0 ? 100.0 * stats.empty_cells / stats.cell_count : 0;
+    auto per_object = stats.object_count > 0 ? double(stats.references) / stats.object_count : 0;
+    return out << "grid " << stats.resolution[0] << 'x' << stats.resolution[1] << 'x'
+               << stats.resolution[2] << ", " << stats.cell_count << " cells (" << empty
+               << "% empty), " << per_object << " cells per object";
+}
+
+struct grid_shape {
+    // The cells a uniform grid of a given density lays over a box.
+    real bounds_min[3], cell_size[3], inv_cell_size[3];
+    int resolution[3];
+
+    grid_shape() {}
+
+    grid_shape(const aabb& box, size_t object_count, double density) {
+        // Cells as close to cubes as the box allows, about density of them per object.
+        real extent[3];
+        for (int axis = 0; axis < 3; axis++) {
+            bounds_min[axis] = box.axis_interval(axis).min;
+            extent[axis] = std::fmax(box.axis_interval(axis).size(), real(1e-4));
+        }
+        auto volume = double(extent[0]) * extent[1] * extent[2];
+        auto cells_per_unit = std::cbrt(density * std::max<size_t>(object_count, 1) / volume);
+        for (int axis = 0; axis < 3; axis++) {
+            resolution[axis] = std::clamp(int(extent[axis] * cells_per_unit), 1, grid_max_resolution);
+            cell_size[axis] = extent[axis] / resolution[axis];
+            inv_cell_size[axis] = 1 / cell_size[axis];
+        }
+    }
+
+    size_t cell_count() const { return size_t(resolution[0]) * resolution[1] * resolution[2]; }
+
+    int coordinate(real x, int axis) const {
+        return std::clamp(int((x - bounds_min[axis]) * inv_cell_size[axis]), 0, resolution[axis] - 1);
+    }
+
+    size_t index(int x, int y, int z) const {
+        return (size_t(z) * resolution[1] + y) * resolution[0] + x;
+    }
+
+    size_t cell_of(const point3& p) const {
+        return index(coordinate(p.x(), 0), coordinate(p.y(), 1), coordinate(p.z(), 2));
+    }
+
+    size_t cells_overlapped(const aabb& box) const {
+        size_t cells = 1;
+        for (int axis = 0; axis < 3; axis++) {
+            const auto& extent = box.axis_interval(axis);
+            cells *= coordinate(extent.max, axis) - coordinate(extent.min, axis) + 1;
+        }
+        return cells;
+    }
+};
+
+class uniform_grid : public hittable {
+  // A uniform grid of cells over the world's bounds, each listing the objects whose bounds
+  // overlap it. Building is two linear passes, counting then filling, with no sorting or
+  // partitioning, and a ray walks the cells it crosses in order with a 3D-DDA. Grids suit
+  // worlds of many similarly sized objects spread evenly through space; large objects land in
+  // many cells and clustered ones leave most cells empty, and both are better served by a BVH.
+  public:
+    uniform_grid(const hittable_list& list, double density = grid_density)
+      : objects(list.objects), primitives(list.objects)
+    {
+        bbox = list.bounding_box();
+        shape = grid_shape(bbox, objects.size(), density);
+
+        // Count the references of each cell, turn the counts into start offsets, then fill.
+        std::vector<uint32_t> counts(shape.cell_count() + 1, 0);
+        for (const auto& object : objects) {
+            for_each_cell(object->bounding_box(), [&](size_t cell) { counts[cell + 1]++; });
+        }
+        for (size_t cell = 0; cell < shape.cell_count(); cell++)
+            counts[cell + 1] += counts[cell];
+
+        cell_start = counts;
+        references.resize(cell_start.back());
+        for (size_t i = 0; i < objects.size(); i++) {
+            for_each_cell(objects[i]->bounding_box(), [&](size_t cell) {
+                references[counts[cell]++] = uint32_t(i);
+            });
+        }
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        real t_enter = ray_t.min, t_exit = ray_t.max;
+        if (!clip(r, t_enter, t_exit))
+            return false;
+
+        // Cell of the entry point, and for each axis the step direction, the distance at which
+        // the ray crosses into the next cell and the distance between crossings.
+        const point3& origin = r.origin();
+        const vec3& direction = r.direction();
+        const vec3& inv_dir = r.inverse_direction();
+        auto entry = r.at(t_enter);
+
+        int cell[3], step[3], stop[3];
+        real t_next[3], t_delta[3];
+        for (int axis = 0; axis < 3; axis++) {
+            cell[axis] = shape.coordinate(entry[axis], axis);
+            auto cell_min = shape.bounds_min[axis] + cell[axis] * shape.cell_size[axis];
+
+            if (direction[axis] > 0) {
+                step[axis] = 1;
+                stop[axis] = shape.resolution[axis];
+                t_next[axis] = (cell_min + shape.cell_size[axis] - origin[axis]) * inv_dir[axis];
+                t_delta[axis] = shape.cell_size[axis] * inv_dir[axis];
+            } else if (direction[axis] < 0) {
+                step[axis] = -1;
+                stop[axis] = -1;
+                t_next[axis] = (cell_min - origin[axis]) * inv_dir[axis];
+                t_delta[axis] = -shape.cell_size[axis] * inv_dir[axis];
+            } else {
+                step[axis] = 0;
+                stop[axis] = -1;
+                t_next[axis] = infinity;
+                t_delta[axis] = infinity;
+            }
+        }
+
+        // Objects spanning several cells would be tested again in each; a few recently tested
+        // ones are remembered and skipped.
+        constexpr int mailbox_size = 8;
+        uint32_t mailbox[mailbox_size];
+        std::fill(mailbox, mailbox + mailbox_size, UINT32_MAX);
+        int mailbox_next = 0;
+
+        bool hit_anything = false;
+        auto closest = ray_t.max;
+        while (true) {
+            auto index = shape.index(cell[0], cell[1], cell[2]);
+            for (auto k = cell_start[index]; k < cell_start[index + 1]; k++) {
+                auto object = references[k];
+                if (std::find(mailbox, mailbox + mailbox_size, object) != mailbox + mailbox_size)
+                    continue;
+                mailbox[mailbox_next] = object;
+                mailbox_next = (mailbox_next + 1) % mailbox_size;
+
+                if (primitives.hit(object, r, interval(ray_t.min, closest), rec)) {
+                    hit_anything = true;
+                    closest = rec.t;
+                }
+            }
+
+            // A hit inside this cell is the closest; one beyond it may still be beaten by an
+            // object in a cell in between.
+            int axis = (t_next[0] < t_next[1])
+                     ? (t_next[0] < t_next[2] ? 0 : 2)
+                     : (t_next[1] < t_next[2] ? 1 : 2);
+            if (t_next[axis] >= closest || t_next[axis] > t_exit)
+                break;
+
+            cell[axis] += step[axis];
+            if (cell[axis] == stop[axis])
+                break;
+            t_next[axis] += t_delta[axis];
+        }
+
+        return hit_anything;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    grid_stats stats() const {
+        grid_stats result;
+        for (int axis = 0; axis < 3; axis++)
+            result.resolution[axis] = shape.resolution[axis];
+        result.cell_count = shape.cell_count();
+        for (size_t cell = 0; cell < result.cell_count; cell++)
+            result.empty_cells += cell_start[cell] == cell_start[cell + 1];
+        result.references = references.size();
+        result.object_count = objects.size();
+        return result;
+    }
+
+    static bool suits(const hittable_list& list) {
+        // Whether the world looks like one a grid handles well: enough objects, whose centers
+        // fill most cells of a grid of one cell per object and whose bounds each overlap only
+        // a few of those cells. Grids of other densities scale both measures alike.
+        if (list.objects.size() < 256)
+            return false;
+
+        grid_shape shape(list.bounding_box(), list.objects.size(), 1.0);
+        std::vector<bool> occupied(shape.cell_count(), false);
+        double overlap = 0;
+        for (const auto& object : list.objects) {
+            auto box = object->bounding_box();
+            occupied[shape.cell_of(box.centroid())] = true;
+            overlap += shape.cells_overlapped(box);
+        }
+
+        auto filled = double(std::count(occupied.begin(), occupied.end(), true)) / shape.cell_count();
+        return filled >= 0.4 && overlap / list.objects.size() <= 8;
+    }
+
+  private:
+
+    std::vector<shared_ptr<hittable>> objects;  // Owns the objects, in the list's order
+    primitive_arrays primitives;                // The same objects, by type
+    std::vector<uint32_t> cell_start;           // References of cell c are [start[c], start[c+1])
+    std::vector<uint32_t> references;           // Object indices, cell after cell
+    grid_shape shape;
+    aabb bbox;
+
+    template <typename Visit>
+    void for_each_cell(const aabb& box, const Visit& visit) const {
+        // Calls visit(cell) for every cell the box overlaps.
+        int lo[3], hi[3];
+        for (int axis = 0; axis < 3; axis++) {
+            lo[axis] = shape.coordinate(box.axis_interval(axis).min, axis);
+            hi[axis] = shape.coordinate(box.axis_interval(axis).max, axis);
+        }
+        for (int z = lo[2]; z <= hi[2]; z++)
+            for (int y = lo[1]; y <= hi[1]; y++)
+                for (int x = lo[0]; x <= hi[0]; x++)
+                    visit(shape.index(x, y, z));
+    }
+
+    bool clip(const ray& r, real& t_enter, real& t_exit) const {
+        // Narrows [t_enter, t_exit] to the part of the ray inside the grid bounds.
+        const point3& origin = r.origin();
+        const vec3& inv_dir = r.inverse_direction();
+        for (int axis = 0; axis < 3; axis++) {
+            const auto& extent = bbox.axis_interval(axis);
+            auto t0 = (extent.min - origin[axis]) * inv_dir[axis];
+            auto t1 = (extent.max - origin[axis]) * inv_dir[axis];
+            if (t0 > t1)
+                std::swap(t0, t1);
+            t_enter = t0 > t_enter ? t0 : t_enter;
+            t_exit = t1 < t_exit ? t1 : t_exit;
+            if (t_exit < t_enter)
+                return false;
+        }
+        return true;
+    }
+};
+
+#endif
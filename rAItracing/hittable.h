@@ -10,16 +10,23 @@
 
 #include "aabb.h"
 
+class hittable;
 class material;
 
 class hit_record {
+  // Traversal fills in only t, the material and whatever the primitive needs to finish the job
+  // later, and points object at that primitive. finalize() then computes the rest once, for
+  // the closest hit alone.
   public:
+    const hittable* object = nullptr;  // Primitive to finish the record, null once finished
+    const hittable* inner = nullptr;   // When object is an instance, what its object hit
     point3 p;
     vec3 normal;
-    shared_ptr<material> mat;
-    double t;
-    double u;
-    double v;
+    uint32_t material_id;  // Index into global_materials()
+    uint32_t primitive;    // Which part of object was hit, for objects made of many
+    real t;
+    real u;
+    real v;
     bool front_face;
 
     void set_face_normal(const ray& r, const vec3& outward_normal) {
@@ -29,6 +36,8 @@ class hit_record {
         front_face = dot(r.direction(), outward_normal) < 0;
         normal = front_face ? outward_normal : -outward_normal;
     }
+
+    inline void finalize(const ray& r);
 };
 
 class hittable {
@@ -36,8 +45,54 @@ class hittable {
     virtual ~hittable() = default;
 
     virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
-    
+
+    virtual void hit_packet(
+        const ray* rays, int count, interval ray_t, hit_record* recs, bool* hits
+    ) const {
+        // Traces a batch of coherent rays. Accelerators with a packet traversal override this;
+        // everything else traces the rays one at a time.
+        for (int k = 0; k < count; k++)
+            hits[k] = hit(rays[k], ray_t, recs[k]);
+    }
+
     virtual aabb bounding_box() const = 0;
+
+    virtual aabb bounding_box_at(real time) const {
+        // Bounds of the object at one instant of the shutter interval [0,1]. Moving objects
+        // override this; bounding_box() covers the whole interval.
+        return bounding_box();
+    }
+
+    virtual aabb clipped_bounding_box(const aabb& region) const {
+        // Bounds of the part of the object inside region, for builders that split objects
+        // between nodes. Flat and thin objects override this with something tighter than the
+        // overlap of their box with the region.
+        return clip_to_box(bounding_box(), region);
+    }
+
+    virtual void finalize_hit(const ray& r, hit_record& rec) const {
+        // Computes the hit point, normal and texture coordinates of a hit this object recorded
+        // with only its distance. Objects whose hit() fills in the whole record should set
+        // rec.object to null instead.
+    }
 };
 
+inline bool hit_fresh(const hittable& object, const ray& r, interval ray_t, hit_record& rec) {
+    // Intersects an arbitrary object for a container that tests several into one record. An
+    // object whose hit() fills in the whole record leaves rec.object as it found it, which may
+    // be an earlier candidate, so it is traced into a fresh record; rec changes only on a hit.
+    hit_record fresh;
+    if (!object.hit(r, ray_t, fresh))
+        return false;
+    rec = fresh;
+    return true;
+}
+
+inline void hit_record::finalize(const ray& r) {
+    if (object) {
+        object->finalize_hit(r, *this);
+        object = nullptr;
+    }
+}
+
 #endif
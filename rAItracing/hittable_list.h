@@ -29,15 +29,13 @@ class hittable_list : public hittable {
     }
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-        hit_record temp_rec;
         bool hit_anything = false;
         auto closest_so_far = ray_t.max;
 
         for (const auto& object : objects) {
-            if (object->hit(r, interval(ray_t.min, closest_so_far), temp_rec)) {
+            if (hit_fresh(*object, r, interval(ray_t.min, closest_so_far), rec)) {
                 hit_anything = true;
-                closest_so_far = temp_rec.t;
-                rec = temp_rec;
+                closest_so_far = rec.t;
             }
         }
 
@@ -46,6 +44,13 @@ class hittable_list : public hittable {
     
     aabb bounding_box() const override { return bbox; }
 
+    aabb bounding_box_at(real time) const override {
+        aabb box;
+        for (const auto& object : objects)
+            box = aabb(box, object->bounding_box_at(time));
+        return box;
+    }
+
   private:
     aabb bbox;
 };
@@ -0,0 +1,74 @@
+//
+//  instance.h
+//  rAItracing
+//
+
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "hittable.h"
+#include "transform.h"
+
+class instance final : public hittable {
+  // A placed copy of a shared object, usually a prebuilt accelerator or mesh: any number of
+  // instances can point at one object, which is stored once. Rays are moved into the object's
+  // space rather than the object into the world, and an accelerator over the world treats each
+  // instance as a single primitive.
+  public:
+    instance(shared_ptr<hittable> object, const transform& object_to_world)
+      : object(object), to_world(object_to_world), to_object(object_to_world.inverse())
+    {
+        bbox = to_world.apply(object->bounding_box());
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        // The object-space direction is not renormalized, so hit distances need no conversion.
+        ray object_ray = to_object.apply(r);
+        if (!hit_fresh(*object, object_ray, ray_t, rec))
+            return false;
+
+        // The record keeps what the object hit, in its own space, for finalize_hit. The record
+        // has room for one level only, so a nested instance is finished now; the class being
+        // final makes the check a vtable comparison.
+        if (dynamic_cast<const instance*>(rec.object))
+            rec.finalize(object_ray);
+        rec.inner = rec.object;
+        rec.object = this;
+        return true;
+    }
+
+    void finalize_hit(const ray& r, hit_record& rec) const override {
+        // Finishes the object's hit with the ray in object space, then moves the result into
+        // world space. Normals map by the inverse transpose. The face side is unchanged by an
+        // affine map, since the dot product of direction and normal is the same in both spaces.
+        rec.object = rec.inner;
+        rec.inner = nullptr;
+        rec.finalize(to_object.apply(r));
+        rec.p = r.at(rec.t);
+        rec.normal = unit_vector(to_object.apply_transposed(rec.normal));
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    aabb bounding_box_at(real time) const override {
+        return to_world.apply(object->bounding_box_at(time));
+    }
+
+    const transform& object_to_world() const { return to_world; }
+
+    void set_transform(const transform& object_to_world) {
+        // Moves the instance. Not safe while a render is tracing it; an accelerator holding the
+        // instance has to be refit or rebuilt afterwards.
+        to_world = object_to_world;
+        to_object = object_to_world.inverse();
+        bbox = to_world.apply(object->bounding_box());
+    }
+
+  private:
+    shared_ptr<hittable> object;
+    transform to_world;
+    transform to_object;
+    aabb bbox;
+};
+
+#endif
@@ -10,11 +10,11 @@
 
 class interval {
   public:
-    double min, max;
+    real min, max;
 
     interval() : min(+infinity), max(-infinity) {} // Default interval is empty
 
-    interval(double min, double max) : min(min), max(max) {}
+    interval(real min, real max) : min(min), max(max) {}
     
     interval(const interval& a, const interval& b) {
         // Create the interval tightly enclosing the two input intervals.
@@ -22,25 +22,25 @@ class interval {
         max = a.max >= b.max ? a.max : b.max;
     }
 
-    double size() const {
+    real size() const {
         return max - min;
     }
 
-    bool contains(double x) const {
+    bool contains(real x) const {
         return min <= x && x <= max;
     }
 
-    bool surrounds(double x) const {
+    bool surrounds(real x) const {
         return min < x && x < max;
     }
     
-    double clamp(double x) const {
+    real clamp(real x) const {
         if (x < min) return min;
         if (x > max) return max;
         return x;
     }
     
-    interval expand(double delta) const {
+    interval expand(real delta) const {
         auto padding = delta/2;
         return interval(min - padding, max + padding);
     }
@@ -0,0 +1,1001 @@
+//
+//  linear_bvh.h
+//  rAItracing
+//
+
+#ifndef LINEAR_BVH_H
+#define LINEAR_BVH_H
+
+#include "aabb.h"
+#include "bvh_build.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "primitive_arrays.h"
+#include "ray_packet.h"
+#include "sphere_pack.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+struct alignas(32) linear_bvh_node {
+    // A BVH node packed into 32 bytes and aligned to them, so two of them share a cache line and
+    // none straddles two. The bounds are stored as floats rounded outward, which keeps them
+    // conservative for rays of either precision.
+
+    float    bounds_min[3];
+    float    bounds_max[3];
+    uint32_t offset;           // Leaf: index of the first primitive, or of its sphere pack.
+                               // Interior: second child.
+    uint16_t primitive_count;  // Number of primitives in a leaf, 0 for interior nodes.
+    uint8_t  axis;             // Axis the interior node was split along.
+    uint8_t  packed;           // Leaf: 1 when its primitives are stored as a sphere pack.
+
+    bool is_leaf() const { return primitive_count > 0; }
+
+    void set_bounds(const aabb& box) {
+        for (int axis = 0; axis < 3; axis++) {
+            bounds_min[axis] = round_down_to_float(box.axis_interval(axis).min);
+            bounds_max[axis] = round_up_to_float(box.axis_interval(axis).max);
+        }
+    }
+
+    aabb bounds() const {
+        return aabb(interval(bounds_min[0], bounds_max[0]),
+                    interval(bounds_min[1], bounds_max[1]),
+                    interval(bounds_min[2], bounds_max[2]));
+    }
+
+    bool hit(const ray& r, const interval& ray_t, real& t_enter) const {
+        // Slab test with the ray's precomputed reciprocal direction. The direction signs pick
+        // the entry and exit plane of each axis, so the distances need no sorting.
+        const point3& origin = r.origin();
+        const vec3& inv_dir = r.inverse_direction();
+        const float* entry[2] = {bounds_min, bounds_max};
+        auto t_min = ray_t.min;
+        auto t_max = ray_t.max;
+
+        for (int axis = 0; axis < 3; axis++) {
+            int neg = r.dir_is_neg(axis);
+            auto t0 = (entry[neg][axis] - origin[axis]) * inv_dir[axis];
+            auto t1 = (entry[1 - neg][axis] - origin[axis]) * inv_dir[axis];
+
+            // Written so that a NaN (ray origin on a slab plane, zero direction) keeps the range.
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+
+            if (t_max < t_min)
+                return false;
+        }
+
+        t_enter = t_min;
+        return true;
+    }
+};
+
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node should fill exactly 32 bytes");
+
+class linear_bvh_optimizer {
+  // Lowers the SAH cost of a finished tree by treelet restructuring (Karras and Aila, "Fast
+  // Parallel Construction of High-Quality Bounding Volume Hierarchies"). Every interior node,
+  // children before parents, grows a treelet by repeatedly opening its largest subtree until it
+  // has bvh_treelet_leaves of them, and a search over all subsets of those subtrees finds the
+  // cheapest binary tree over them. The subtrees themselves and the leaves are left alone, so
+  // the primitive order is unchanged. Passes stop when the time budget runs out.
+  //
+  // The nodes are then written out again in the builder's layout, depth first with the child
+  // lower along the split axis first, so that the restructured subtrees are contiguous in
+  // memory again. Trees that restructuring would make deeper than the traversal stack are kept
+  // as built.
+  public:
+    explicit linear_bvh_optimizer(double milliseconds) : milliseconds(milliseconds) {}
+
+    bvh_treelet_stats optimize(std::vector<linear_bvh_node>& nodes, int max_depth) const {
+        using clock = std::chrono::steady_clock;
+        auto start = clock::now();
+        auto deadline = start + std::chrono::duration_cast<clock::duration>(
+            std::chrono::duration<double, std::milli>(milliseconds));
+
+        bvh_treelet_stats stats;
+        if (nodes.empty())
+            return stats;
+
+        std::vector<tree_node> tree(nodes.size());
+        link(nodes, tree, 0);
+        stats.sah_before = sah_cost(tree);
+
+        std::vector<uint32_t> order;
+        while (stats.passes < bvh_treelet_passes && !stats.timed_out) {
+            stats.passes++;
+            post_order(tree, order);
+            size_t restructured = stats.restructured;
+            for (auto index : order) {
+                if (clock::now() >= deadline) {
+                    stats.timed_out = true;
+                    break;
+                }
+                auto& node = tree[index];
+                if (node.leaf)
+                    continue;
+                node.cost = bvh_traversal_cost * node.area + tree[node.child[0]].cost + tree[node.child[1]].cost;
+                node.height = 1 + std::max(tree[node.child[0]].height, tree[node.child[1]].height);
+                stats.treelets++;
+                stats.restructured += restructure(tree, index);
+            }
+            if (stats.restructured == restructured)
+                break;
+        }
+
+        // A pass cut short leaves the costs above the last restructured treelet out of date.
+        post_order(tree, order);
+        for (auto index : order) {
+            auto& node = tree[index];
+            if (!node.leaf) {
+                node.cost = bvh_traversal_cost * node.area + tree[node.child[0]].cost + tree[node.child[1]].cost;
+                node.height = 1 + std::max(tree[node.child[0]].height, tree[node.child[1]].height);
+            }
+        }
+
+        stats.sah_after = sah_cost(tree);
+        if (tree[0].height < max_depth) {
+            std::vector<linear_bvh_node> laid_out;
+            laid_out.reserve(nodes.size());
+            lay_out(nodes, tree, 0, laid_out);
+            nodes = std::move(laid_out);
+        } else {
+            stats.sah_after = stats.sah_before;
+            stats.restructured = 0;
+        }
+
+        stats.milliseconds = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+        return stats;
+    }
+
+  private:
+    struct box {
+        float lo[3], hi[3];
+
+        box() {}
+        box(const box& a, const box& b) {
+            for (int axis = 0; axis < 3; axis++) {
+                lo[axis] = std::min(a.lo[axis], b.lo[axis]);
+                hi[axis] = std::max(a.hi[axis], b.hi[axis]);
+            }
+        }
+
+        double area() const {
+            double dx = hi[0] - lo[0], dy = hi[1] - lo[1], dz = hi[2] - lo[2];
+            return 2 * (dx*dy + dy*dz + dz*dx);
+        }
+    };
+
+    struct tree_node {
+        box      bounds;
+        double   area;
+        double   cost;      // SAH cost of the subtree, not yet divided by any root area
+        uint32_t child[2];
+        uint32_t source;    // Index of the node in the built tree, which leaves are copied from
+        int      height;
+        bool     leaf;
+    };
+
+    double milliseconds;
+
+    static double sah_cost(const std::vector<tree_node>& tree) {
+        return tree[0].area > 0 ? tree[0].cost / tree[0].area : 0;
+    }
+
+    static void link(const std::vector<linear_bvh_node>& nodes, std::vector<tree_node>& tree, uint32_t index) {
+        // Gives each node explicit children, keeping its index, and computes the subtree costs.
+        const auto& node = nodes[index];
+        auto& t = tree[index];
+        std::copy(node.bounds_min, node.bounds_min + 3, t.bounds.lo);
+        std::copy(node.bounds_max, node.bounds_max + 3, t.bounds.hi);
+        t.area = t.bounds.area();
+        t.source = index;
+        t.leaf = node.is_leaf();
+
+        if (t.leaf) {
+            t.cost = bvh_intersection_cost * node.primitive_count * t.area;
+            t.height = 0;
+            return;
+        }
+
+        t.child[0] = index + 1;
+        t.child[1] = node.offset;
+        link(nodes, tree, index + 1);
+        link(nodes, tree, node.offset);
+        t.cost = bvh_traversal_cost * t.area + tree[index + 1].cost + tree[node.offset].cost;
+        t.height = 1 + std::max(tree[index + 1].height, tree[node.offset].height);
+    }
+
+    static void post_order(const std::vector<tree_node>& tree, std::vector<uint32_t>& order) {
+        // Every interior node after its children.
+        order.clear();
+        std::vector<uint32_t> stack = {0};
+        while (!stack.empty()) {
+            auto index = stack.back();
+            stack.pop_back();
+            order.push_back(index);
+            if (!tree[index].leaf) {
+                stack.push_back(tree[index].child[0]);
+                stack.push_back(tree[index].child[1]);
+            }
+        }
+        std::reverse(order.begin(), order.end());
+    }
+
+    static bool restructure(std::vector<tree_node>& tree, uint32_t root) {
+        // Opens the largest subtree of the treelet until it has enough of them.
+        uint32_t leaves[bvh_treelet_leaves], inner[bvh_treelet_leaves];
+        int leaf_count = 2, inner_count = 1;
+        leaves[0] = tree[root].child[0];
+        leaves[1] = tree[root].child[1];
+        inner[0] = root;
+
+        while (leaf_count < bvh_treelet_leaves) {
+            int largest = -1;
+            for (int k = 0; k < leaf_count; k++) {
+                if (!tree[leaves[k]].leaf && (largest < 0 || tree[leaves[k]].area > tree[leaves[largest]].area))
+                    largest = k;
+            }
+            if (largest < 0)
+                break;
+
+            auto opened = leaves[largest];
+            inner[inner_count++] = opened;
+            leaves[largest] = tree[opened].child[0];
+            leaves[leaf_count++] = tree[opened].child[1];
+        }
+        if (leaf_count < 3)
+            return false;
+
+        // Cheapest tree over every subset of the subtrees, from smaller subsets to larger. A
+        // subset's two halves are enumerated with its lowest member always in the first.
+        constexpr int subsets = 1 << bvh_treelet_leaves;
+        box bounds[subsets];
+        double cost[subsets];
+        uint8_t split[subsets];
+        int full = (1 << leaf_count) - 1;
+
+        for (int s = 1; s <= full; s++) {
+            int low = s & -s;
+            if (s == low) {
+                int k = std::countr_zero(unsigned(s));
+                bounds[s] = tree[leaves[k]].bounds;
+                cost[s] = tree[leaves[k]].cost;
+                continue;
+            }
+
+            bounds[s] = box(bounds[s - low], bounds[low]);
+            double best = infinity;
+            for (int p = (s - 1) & s; p != 0; p = (p - 1) & s) {
+                if (!(p & low))
+                    continue;
+                auto c = cost[p] + cost[s ^ p];
+                if (c < best) {
+                    best = c;
+                    split[s] = uint8_t(p);
+                }
+            }
+            cost[s] = bvh_traversal_cost * bounds[s].area() + best;
+        }
+
+        if (cost[full] >= tree[root].cost * (1 - 1e-9))
+            return false;
+
+        // Rebuild the treelet with the same interior nodes, the root keeping its index.
+        int next_inner = 1;
+        auto rebuild = [&](auto& self, int s, uint32_t index) -> uint32_t {
+            if ((s & (s - 1)) == 0)
+                return leaves[std::countr_zero(unsigned(s))];
+
+            auto p = split[s];
+            auto first = self(self, p, (p & (p - 1)) ? inner[next_inner++] : 0);
+            auto second = self(self, s ^ p, ((s ^ p) & ((s ^ p) - 1)) ? inner[next_inner++] : 0);
+
+            auto& node = tree[index];
+            node.child[0] = first;
+            node.child[1] = second;
+            node.bounds = bounds[s];
+            node.area = node.bounds.area();
+            node.cost = cost[s];
+            node.height = 1 + std::max(tree[first].height, tree[second].height);
+            return index;
+        };
+        rebuild(rebuild, full, root);
+        return true;
+    }
+
+    static uint32_t lay_out(
+        const std::vector<linear_bvh_node>& built, const std::vector<tree_node>& tree, uint32_t index,
+        std::vector<linear_bvh_node>& out
+    ) {
+        // Writes the subtree depth first and returns its new index. The packet traversal visits
+        // the first child first for rays going up the axis, so the axis is the one that best
+        // separates the children and the first child is the lower one along it.
+        auto out_index = uint32_t(out.size());
+        const auto& t = tree[index];
+        if (t.leaf) {
+            out.push_back(built[t.source]);
+            return out_index;
+        }
+
+        auto first = t.child[0], second = t.child[1];
+        int axis = 0;
+        float separation[3];
+        for (int k = 0; k < 3; k++) {
+            const auto& a = tree[first].bounds;
+            const auto& b = tree[second].bounds;
+            separation[k] = (a.lo[k] + a.hi[k]) - (b.lo[k] + b.hi[k]);
+            if (std::fabs(separation[k]) > std::fabs(separation[axis]))
+                axis = k;
+        }
+        if (separation[axis] > 0)
+            std::swap(first, second);
+
+        out.emplace_back();
+        lay_out(built, tree, first, out);
+        auto second_index = lay_out(built, tree, second, out);
+
+        auto& node = out[out_index];
+        std::copy(t.bounds.lo, t.bounds.lo + 3, node.bounds_min);
+        std::copy(t.bounds.hi, t.bounds.hi + 3, node.bounds_max);
+        node.offset = second_index;
+        node.primitive_count = 0;
+        node.axis = uint8_t(axis);
+        node.packed = 0;
+        return out_index;
+    }
+};
+
+class linear_bvh_builder {
+  // Builds a flattened BVH over primitives known only by their bounds, so every tree of
+  // linear_bvh_nodes shares one builder whatever it stores in its leaves. Large inputs are built
+  // on a thread pool: primitive bounds, node bounds and SAH bins are reduced over chunks, and
+  // the two halves of big nodes are built as separate tasks. Both reductions and the subtree
+  // splicing are order independent, so the result is the same tree, node for node, as the
+  // serial build.
+  public:
+    static constexpr int max_depth = 64;  // Traversal stack size; deeper subtrees become leaves
+
+    struct build_output {
+        std::vector<linear_bvh_node> nodes;
+        std::vector<uint32_t> order;  // Primitive indices in leaf order; leaves index into it
+        bvh_treelet_stats treelets;   // Set when the options ask for treelet restructuring
+    };
+
+    explicit linear_bvh_builder(const bvh_build_options& options) : options(options) {
+        this->options.max_leaf_size = std::clamp(options.max_leaf_size, 1, 0xffff);
+    }
+
+    template <typename BoxOf>
+    build_output build(size_t count, const BoxOf& box_of_primitive) const {
+        // box_of_primitive(i) returns the bounds of primitive i, for i in [0,count).
+        std::unique_ptr<thread_pool> pool;
+        if (options.thread_count != 1 && count >= bvh_parallel_build_threshold)
+            pool = std::make_unique<thread_pool>(options.thread_count);
+
+        std::vector<build_primitive> build_prims(count);
+        for_chunks(pool.get(), 0, count, [&](size_t, size_t first, size_t last) {
+            for (size_t i = first; i < last; i++)
+                build_prims[i] = {box_of_primitive(i), uint32_t(i)};
+        });
+
+        build_output out;
+        out.nodes.reserve(2 * count);
+        out.order.reserve(count);
+        if (count > 0)
+            build_node(out, build_prims, 0, count, 0, pool.get());
+        out.nodes.shrink_to_fit();  // Room was reserved for leaves of one primitive
+        optimize(out);
+        return out;
+    }
+
+    template <typename BoxOf, typename ClipOf>
+    build_output build(size_t count, const BoxOf& box_of_primitive, const ClipOf& clip_primitive) const {
+        // As above, with spatial splits if the options ask for them. clip_primitive(i, region)
+        // returns the bounds of the part of primitive i inside region. A primitive split between
+        // nodes appears in several leaves, so order may list it more than once. Spatial split
+        // builds are serial.
+        if (!options.spatial_splits)
+            return build(count, box_of_primitive);
+
+        std::vector<build_primitive> references(count);
+        for (size_t i = 0; i < count; i++)
+            references[i] = {box_of_primitive(i), uint32_t(i)};
+
+        auto root_area = node_bounds(references, 0, count, nullptr).surface_area();
+        spatial_build<ClipOf> state{clip_primitive, size_t(options.max_duplication * count),
+                                    bvh_spatial_split_overlap * root_area};
+
+        build_output out;
+        out.nodes.reserve(2 * count);
+        out.order.reserve(count + state.duplicates_left);
+        if (count > 0)
+            build_spatial_node(out, std::move(references), 0, state);
+        out.nodes.shrink_to_fit();
+        optimize(out);
+        return out;
+    }
+
+  private:
+    struct build_primitive {
+        aabb     box;
+        uint32_t index;  // Index of the primitive in the caller's sequence
+    };
+
+    bvh_build_options options;
+
+    static const aabb& box_of(const build_primitive& p) { return p.box; }
+
+    void optimize(build_output& out) const {
+        if (options.treelet_milliseconds > 0)
+            out.treelets = linear_bvh_optimizer(options.treelet_milliseconds).optimize(out.nodes, max_depth);
+    }
+
+    uint32_t build_node(
+        build_output& out, std::vector<build_primitive>& build_prims, size_t start, size_t end,
+        int depth, thread_pool* pool
+    ) const {
+        auto node_index = uint32_t(out.nodes.size());
+        out.nodes.emplace_back();
+
+        size_t object_span = end - start;
+        auto node_pool = (object_span >= bvh_parallel_build_threshold) ? pool : nullptr;
+
+        aabb box = node_bounds(build_prims, start, end, node_pool);
+
+        if (object_span <= size_t(options.max_leaf_size) || depth + 1 >= max_depth) {
+            auto& node = out.nodes[node_index];
+            node.set_bounds(box);
+            node.offset = uint32_t(out.order.size());
+            node.primitive_count = uint16_t(object_span);
+            node.axis = 0;
+
+            for (size_t i = start; i < end; i++)
+                out.order.push_back(build_prims[i].index);
+            return node_index;
+        }
+
+        // Deep in the tree switch to median splits, which halve the span, so that lopsided SAH
+        // splits cannot overflow the traversal stack.
+        int axis;
+        auto method = (depth < max_depth - 24) ? options.split : bvh_split::median;
+        auto mid = node_pool ? parallel_partition(method, build_prims, start, end, box, axis, node_pool)
+                             : bvh_partition(method, build_prims, start, end, box, box_of, axis);
+
+        uint32_t second;
+        if (node_pool) {
+            build_output halves[2];
+            node_pool->parallel_for(2, [&](size_t k) {
+                if (k == 0)
+                    build_node(halves[0], build_prims, start, mid, depth + 1, pool);
+                else
+                    build_node(halves[1], build_prims, mid, end, depth + 1, pool);
+            });
+            append(out, halves[0]);
+            second = append(out, halves[1]);
+        } else {
+            build_node(out, build_prims, start, mid, depth + 1, pool);
+            second = build_node(out, build_prims, mid, end, depth + 1, pool);
+        }
+
+        auto& node = out.nodes[node_index];
+        node.set_bounds(box);
+        node.offset = second;
+        node.primitive_count = 0;
+        node.axis = uint8_t(axis);
+        return node_index;
+    }
+
+    template <typename ClipOf>
+    struct spatial_build {
+        const ClipOf& clip_primitive;
+        size_t duplicates_left;  // References spatial splits may still add
+        double min_overlap;      // Child overlap area that makes a node try a spatial split
+    };
+
+    template <typename ClipOf>
+    uint32_t build_spatial_node(
+        build_output& out, std::vector<build_primitive> references, int depth, spatial_build<ClipOf>& state
+    ) const {
+        // build_node for spatial split builds. Each node gets its own references, since a spatial
+        // split can send one to both children. The object split is found first, and a spatial
+        // split is only tried when the object split's children overlap.
+        auto node_index = uint32_t(out.nodes.size());
+        out.nodes.emplace_back();
+
+        size_t count = references.size();
+        aabb box = node_bounds(references, 0, count, nullptr);
+
+        if (count <= size_t(options.max_leaf_size) || depth + 1 >= max_depth) {
+            auto& node = out.nodes[node_index];
+            node.set_bounds(box);
+            node.offset = uint32_t(out.order.size());
+            node.primitive_count = uint16_t(count);
+            node.axis = 0;
+
+            for (const auto& reference : references)
+                out.order.push_back(reference.index);
+            return node_index;
+        }
+
+        int axis;
+        auto method = (depth < max_depth - 24) ? options.split : bvh_split::median;
+        auto mid = bvh_partition(method, references, 0, count, box, box_of, axis);
+
+        std::vector<build_primitive> left, right;
+        if (method == bvh_split::sah && state.duplicates_left > 0) {
+            auto left_box = node_bounds(references, 0, mid, nullptr);
+            auto right_box = node_bounds(references, mid, count, nullptr);
+            if (overlap_area(left_box, right_box) > state.min_overlap) {
+                auto object_cost = mid * left_box.surface_area() + (count - mid) * right_box.surface_area();
+                bvh_spatial_binner binner(box);
+                for (const auto& reference : references)
+                    binner.add(reference.box, reference.index, state.clip_primitive);
+
+                int spatial_axis, boundary;
+                double spatial_cost;
+                if (binner.find_split(spatial_axis, boundary, spatial_cost, count) && spatial_cost < object_cost
+                    && split_references(references, binner, spatial_axis, boundary, state, left, right))
+                    axis = spatial_axis;
+            }
+        }
+
+        if (left.empty()) {
+            left.assign(references.begin(), references.begin() + mid);
+            right.assign(references.begin() + mid, references.end());
+        }
+        std::vector<build_primitive>().swap(references);  // Free before descending
+
+        build_spatial_node(out, std::move(left), depth + 1, state);
+        auto second = build_spatial_node(out, std::move(right), depth + 1, state);
+
+        auto& node = out.nodes[node_index];
+        node.set_bounds(box);
+        node.offset = second;
+        node.primitive_count = 0;
+        node.axis = uint8_t(axis);
+        return node_index;
+    }
+
+    template <typename ClipOf>
+    static bool split_references(
+        const std::vector<build_primitive>& references, const bvh_spatial_binner& binner, int axis,
+        int boundary, spatial_build<ClipOf>& state, std::vector<build_primitive>& left,
+        std::vector<build_primitive>& right
+    ) {
+        // Sends each reference to the side of the split plane it lies on. One that straddles the
+        // plane is clipped in two, unless moving it whole to one side is cheaper ("reference
+        // unsplitting") or the duplication budget is spent. Returns false, leaving both sides
+        // empty, if either side ended up with every reference.
+        struct straddler { const build_primitive* reference; aabb left, right; };
+        std::vector<straddler> straddlers;
+        aabb left_box = aabb::empty, right_box = aabb::empty;
+
+        for (const auto& reference : references) {
+            const auto& extent = reference.box.axis_interval(axis);
+            if (binner.bin_index(extent.max, axis) < boundary) {
+                left.push_back(reference);
+                left_box = aabb(left_box, reference.box);
+            } else if (binner.bin_index(extent.min, axis) >= boundary) {
+                right.push_back(reference);
+                right_box = aabb(right_box, reference.box);
+            } else {
+                auto clip = [&](int first, int last) {
+                    auto region = clip_to_box(reference.box, binner.slab(axis, first, last, reference.box));
+                    return state.clip_primitive(reference.index, region);
+                };
+                straddlers.push_back({&reference, clip(0, boundary), clip(boundary, bvh_sah_bins)});
+                left_box = aabb(left_box, straddlers.back().left);
+                right_box = aabb(right_box, straddlers.back().right);
+            }
+        }
+
+        double left_count = double(left.size() + straddlers.size());
+        double right_count = double(right.size() + straddlers.size());
+        auto left_area = left_box.surface_area();
+        auto right_area = right_box.surface_area();
+        auto split_cost = left_count * left_area + right_count * right_area;
+
+        size_t duplicates = 0;
+        for (const auto& s : straddlers) {
+            const auto& whole = s.reference->box;
+            auto all_left = aabb(left_box, whole).surface_area() * left_count + right_area * (right_count - 1);
+            auto all_right = left_area * (left_count - 1) + aabb(right_box, whole).surface_area() * right_count;
+            bool can_split = duplicates < state.duplicates_left
+                          && s.left.axis_interval(axis).size() >= 0 && s.right.axis_interval(axis).size() >= 0;
+
+            if (can_split && split_cost <= std::min(all_left, all_right)) {
+                left.push_back({s.left, s.reference->index});
+                right.push_back({s.right, s.reference->index});
+                duplicates++;
+            } else if (all_left <= all_right) {
+                left.push_back(*s.reference);
+            } else {
+                right.push_back(*s.reference);
+            }
+        }
+
+        if (left.size() >= references.size() || right.size() >= references.size()) {
+            left.clear();
+            right.clear();
+            return false;
+        }
+        state.duplicates_left -= duplicates;
+        return true;
+    }
+
+    static double overlap_area(const aabb& a, const aabb& b) {
+        double extent[3];
+        for (int axis = 0; axis < 3; axis++) {
+            extent[axis] = std::fmin(a.axis_interval(axis).max, b.axis_interval(axis).max)
+                         - std::fmax(a.axis_interval(axis).min, b.axis_interval(axis).min);
+            if (extent[axis] <= 0)
+                return 0;
+        }
+        return 2 * (extent[0]*extent[1] + extent[1]*extent[2] + extent[2]*extent[0]);
+    }
+
+    static uint32_t append(build_output& out, const build_output& subtree) {
+        // Moves a separately built subtree behind the nodes already in out, rebasing its offsets.
+        auto node_base = uint32_t(out.nodes.size());
+        auto order_base = uint32_t(out.order.size());
+
+        for (auto node : subtree.nodes) {
+            node.offset += node.is_leaf() ? order_base : node_base;
+            out.nodes.push_back(node);
+        }
+        out.order.insert(out.order.end(), subtree.order.begin(), subtree.order.end());
+
+        return node_base;
+    }
+
+    static aabb node_bounds(
+        const std::vector<build_primitive>& build_prims, size_t start, size_t end, thread_pool* pool
+    ) {
+        std::vector<aabb> chunk_boxes(chunk_count(pool, start, end), aabb::empty);
+        for_chunks(pool, start, end, [&](size_t chunk, size_t first, size_t last) {
+            for (size_t i = first; i < last; i++)
+                chunk_boxes[chunk] = aabb(chunk_boxes[chunk], build_prims[i].box);
+        });
+
+        aabb box = aabb::empty;
+        for (const auto& chunk_box : chunk_boxes)
+            box = aabb(box, chunk_box);
+        return box;
+    }
+
+    static size_t parallel_partition(
+        bvh_split method, std::vector<build_primitive>& build_prims, size_t start, size_t end,
+        const aabb& box, int& axis, thread_pool* pool
+    ) {
+        // Same split as bvh_partition, with the centroid bounds and SAH bins reduced over chunks.
+        axis = box.longest_axis();
+        if (method == bvh_split::median)
+            return bvh_median_partition(build_prims, start, end, axis, box_of);
+
+        auto chunks = chunk_count(pool, start, end);
+        std::vector<aabb> chunk_bounds(chunks);
+        for_chunks(pool, start, end, [&](size_t chunk, size_t first, size_t last) {
+            chunk_bounds[chunk] = bvh_centroid_bounds(build_prims, first, last, box_of);
+        });
+
+        aabb centroid_bounds = aabb::empty;
+        for (const auto& bounds : chunk_bounds)
+            centroid_bounds = aabb(centroid_bounds, bounds);
+
+        std::vector<bvh_sah_binner> binners(chunks, bvh_sah_binner(centroid_bounds));
+        for_chunks(pool, start, end, [&](size_t chunk, size_t first, size_t last) {
+            for (size_t i = first; i < last; i++)
+                binners[chunk].add(build_prims[i].box);
+        });
+        for (size_t chunk = 1; chunk < chunks; chunk++)
+            binners[0].merge(binners[chunk]);
+
+        int boundary;
+        if (!binners[0].find_split(axis, boundary))
+            return bvh_median_partition(build_prims, start, end, axis, box_of);
+
+        return bvh_sah_partition(build_prims, start, end, binners[0], axis, boundary, box_of);
+    }
+
+    static constexpr size_t build_chunk_size = 4096;
+
+    static size_t chunk_count(thread_pool* pool, size_t start, size_t end) {
+        return pool ? std::max<size_t>(1, (end - start + build_chunk_size - 1) / build_chunk_size) : 1;
+    }
+
+    template <typename Body>
+    static void for_chunks(thread_pool* pool, size_t start, size_t end, const Body& body) {
+        // Calls body(chunk, begin, end) over consecutive chunks of [start,end), on the pool if
+        // there is one, otherwise as a single chunk on the calling thread.
+        auto chunks = chunk_count(pool, start, end);
+        if (chunks == 1) {
+            body(0, start, end);
+            return;
+        }
+
+        pool->parallel_for(chunks, [&](size_t chunk) {
+            auto begin = start + chunk * build_chunk_size;
+            body(chunk, begin, std::min(end, begin + build_chunk_size));
+        });
+    }
+};
+
+template <typename NodeHit, typename LeafHit>
+bool linear_bvh_traverse(
+    const std::vector<linear_bvh_node>& nodes, interval ray_t, hit_record& rec,
+    const NodeHit& node_hit, const LeafHit& leaf_hit
+) {
+    // Nearest-first traversal of a flattened tree. node_hit(index, ray_t, t_enter) tests the ray
+    // against the bounds of a node, and leaf_hit(node, ray_t, rec) intersects the primitives of
+    // a leaf; both return true on a hit within ray_t.
+    if (nodes.empty())
+        return false;
+
+    real root_t;
+    if (!node_hit(uint32_t(0), ray_t, root_t))
+        return false;
+
+    struct stack_entry { uint32_t node; real t_enter; };
+    stack_entry stack[linear_bvh_builder::max_depth];
+    int stack_size = 0;
+
+    bool hit_anything = false;
+    uint32_t current = 0;
+
+    while (true) {
+        const auto& node = nodes[current];
+
+        if (node.is_leaf()) {
+            if (leaf_hit(node, ray_t, rec)) {
+                hit_anything = true;
+                ray_t.max = rec.t;
+            }
+        } else {
+            // Test both children and descend into the nearer one first, deferring the other.
+            uint32_t first = current + 1;
+            uint32_t second = node.offset;
+            real t_first, t_second;
+            bool hit_first = node_hit(first, ray_t, t_first);
+            bool hit_second = node_hit(second, ray_t, t_second);
+
+            if (hit_first && hit_second) {
+                if (t_second < t_first) {
+                    std::swap(first, second);
+                    std::swap(t_first, t_second);
+                }
+                stack[stack_size++] = {second, t_second};
+                current = first;
+                continue;
+            }
+            if (hit_first)  { current = first;  continue; }
+            if (hit_second) { current = second; continue; }
+        }
+
+        // Pop the next deferred child, skipping any that start beyond the closest hit.
+        while (stack_size > 0 && stack[stack_size - 1].t_enter > ray_t.max)
+            stack_size--;
+        if (stack_size == 0)
+            break;
+        current = stack[--stack_size].node;
+    }
+
+    return hit_anything;
+}
+
+template <typename LeafHit>
+bool linear_bvh_traverse(
+    const std::vector<linear_bvh_node>& nodes, const ray& r, interval ray_t, hit_record& rec,
+    const LeafHit& leaf_hit
+) {
+    // The same traversal against the nodes' own bounds.
+    return linear_bvh_traverse(nodes, ray_t, rec,
+        [&](uint32_t index, const interval& node_t, real& t_enter) {
+            return nodes[index].hit(r, node_t, t_enter);
+        },
+        leaf_hit);
+}
+
+template <int N, typename NodeMask, typename LeafHit>
+void linear_bvh_traverse_packet(
+    const std::vector<linear_bvh_node>& nodes, const ray* rays, int count, interval ray_t,
+    hit_record* recs, bool* hits, const NodeMask& node_mask, const LeafHit& leaf_hit
+) {
+    // Visits every node that any ray of the packet overlaps, testing the node against all rays
+    // at once. Children are ordered by the first ray's direction, which suits the whole packet
+    // as long as its rays are coherent. node_mask(packet, index) returns the rays that overlap
+    // a node's bounds and leaf_hit(node, ray, ray_t, rec) intersects one ray with a leaf.
+    real t_max[N];
+    for (int k = 0; k < count; k++) {
+        t_max[k] = ray_t.max;
+        hits[k] = false;
+    }
+    if (nodes.empty())
+        return;
+
+    ray_packet<N> packet(rays, count, ray_t);
+
+    uint32_t stack[linear_bvh_builder::max_depth];
+    int stack_size = 0;
+    uint32_t current = 0;
+
+    while (true) {
+        const auto& node = nodes[current];
+        int mask = node_mask(packet, current);
+
+        if (mask != 0) {
+            if (!node.is_leaf()) {
+                bool second_first = packet.dir_is_neg[node.axis];
+                stack[stack_size++] = second_first ? current + 1 : node.offset;
+                current = second_first ? node.offset : current + 1;
+                continue;
+            }
+
+            for (int lanes = mask; lanes != 0; lanes &= lanes - 1) {
+                int k = std::countr_zero(unsigned(lanes));
+                if (leaf_hit(node, rays[k], interval(ray_t.min, t_max[k]), recs[k])) {
+                    hits[k] = true;
+                    t_max[k] = recs[k].t;
+                    packet.set_t_max(k, recs[k].t);
+                }
+            }
+        }
+
+        if (stack_size == 0)
+            break;
+        current = stack[--stack_size];
+    }
+}
+
+inline void linear_bvh_pack_spheres(
+    std::vector<linear_bvh_node>& nodes, const primitive_arrays& primitives,
+    std::vector<sphere_pack>& packs
+) {
+    // Moves every leaf of two or more spheres into a sphere pack. The spheres stay in the
+    // primitive list as well, so the leaf order is unchanged for other node layouts.
+    for (auto& node : nodes) {
+        if (!node.is_leaf() || node.primitive_count < 2 || node.primitive_count > sphere_pack_width)
+            continue;
+
+        sphere_pack pack;
+        pack.first_primitive = node.offset;
+        for (uint32_t k = 0; k < node.primitive_count; k++) {
+            auto s = primitives.sphere_at(node.offset + k);
+            if (!s)
+                break;
+            pack.add(s);
+        }
+        if (pack.size() != node.primitive_count)
+            continue;
+
+        node.offset = uint32_t(packs.size());
+        node.packed = 1;
+        packs.push_back(pack);
+    }
+}
+
+class linear_bvh : public hittable {
+  public:
+    static constexpr int max_depth = linear_bvh_builder::max_depth;
+
+    linear_bvh(const hittable_list& list, bvh_split split = bvh_split::sah, int max_leaf_size = 4)
+      : linear_bvh(list, bvh_build_options{split, max_leaf_size}) {}
+
+    linear_bvh(const hittable_list& list, const bvh_build_options& options) {
+        auto tree = linear_bvh_builder(options).build(list.objects.size(),
+            [&](size_t i) { return list.objects[i]->bounding_box(); },
+            [&](size_t i, const aabb& region) { return list.objects[i]->clipped_bounding_box(region); });
+        nodes = std::move(tree.nodes);
+        treelets = tree.treelets;
+
+        objects.reserve(tree.order.size());
+        for (auto index : tree.order)
+            objects.push_back(list.objects[index]);
+        primitives = make_shared<primitive_arrays>(objects);
+
+        if (options.pack_spheres)
+            linear_bvh_pack_spheres(nodes, *primitives, packs);
+
+        bbox = list.bounding_box();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        return linear_bvh_traverse(nodes, r, ray_t, rec,
+            [&](const linear_bvh_node& node, interval leaf_t, hit_record& leaf_rec) {
+                return leaf_hit(node, r, leaf_t, leaf_rec);
+            });
+    }
+
+    void hit_packet(
+        const ray* rays, int count, interval ray_t, hit_record* recs, bool* hits
+    ) const override {
+        // Batches of up to max_ray_packet rays walk the tree together.
+        for (int first = 0; first < count; first += max_ray_packet) {
+            int n = std::min(count - first, max_ray_packet);
+            if (n <= 4)
+                trace_packet<4>(rays + first, n, ray_t, recs + first, hits + first);
+            else if (n <= 8)
+                trace_packet<8>(rays + first, n, ray_t, recs + first, hits + first);
+            else
+                trace_packet<16>(rays + first, n, ray_t, recs + first, hits + first);
+        }
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    size_t node_count() const { return nodes.size(); }
+
+    // The flattened tree, its primitives in leaf order and its sphere packs, for building other
+    // node layouts. The packs point into the primitive arrays.
+    const std::vector<linear_bvh_node>& flat_nodes() const { return nodes; }
+    const std::vector<shared_ptr<hittable>>& leaf_objects() const { return objects; }
+    shared_ptr<const primitive_arrays> leaf_primitives() const { return primitives; }
+    const std::vector<sphere_pack>& sphere_packs() const { return packs; }
+
+    const bvh_treelet_stats& treelet_stats() const { return treelets; }
+
+    bvh_stats stats() const {
+        bvh_stats result;
+        if (!nodes.empty()) {
+            accumulate_stats(result, 0, 0);
+            result.finish(nodes[0].bounds());
+        }
+        return result;
+    }
+
+  private:
+    std::vector<linear_bvh_node> nodes;       // Depth-first order, first child follows its parent
+    std::vector<shared_ptr<hittable>> objects;  // Primitives in leaf order, owns them
+    shared_ptr<primitive_arrays> primitives;    // Objects by type, used by traversal
+    std::vector<sphere_pack> packs;             // Leaves made only of spheres
+    bvh_treelet_stats treelets;
+    aabb bbox;
+
+    bool leaf_hit(const linear_bvh_node& node, const ray& r, interval ray_t, hit_record& rec) const {
+        if (node.packed)
+            return packs[node.offset].hit(r, ray_t, rec);
+
+        bool hit_anything = false;
+        for (uint32_t k = 0; k < node.primitive_count; k++) {
+            if (primitives->hit(node.offset + k, r, ray_t, rec)) {
+                hit_anything = true;
+                ray_t.max = rec.t;
+            }
+        }
+        return hit_anything;
+    }
+
+    template <int N>
+    void trace_packet(
+        const ray* rays, int count, interval ray_t, hit_record* recs, bool* hits
+    ) const {
+        linear_bvh_traverse_packet<N>(nodes, rays, count, ray_t, recs, hits,
+            [&](const ray_packet<N>& packet, uint32_t index) {
+                return packet.hit(nodes[index].bounds_min, nodes[index].bounds_max);
+            },
+            [&](const linear_bvh_node& node, const ray& r, interval leaf_t, hit_record& rec) {
+                return leaf_hit(node, r, leaf_t, rec);
+            });
+    }
+
+    void accumulate_stats(bvh_stats& stats, uint32_t index, int depth) const {
+        const auto& node = nodes[index];
+        if (node.is_leaf()) {
+            stats.add_leaf(node.bounds(), node.primitive_count, depth);
+            return;
+        }
+
+        stats.add_interior(node.bounds(), depth);
+        accumulate_stats(stats, index + 1, depth + 1);
+        accumulate_stats(stats, node.offset, depth + 1);
+    }
+};
+
+#endif
@@ -17,15 +17,22 @@
 
 #include "constants.h"
 
+#include "benchmark.h"
 #include "bvh.h"
 #include "camera.h"
 #include "crow_all.h"
 #include "hittable.h"
 #include "hittable_list.h"
+#include "instance.h"
+#include "linear_bvh.h"
 #include "material.h"
+#include "mesh_loader.h"
+#include "plane.h"
 #include "quad.h"
+#include "scene.h"
 #include "sphere.h"
 #include "texture.h"
+#include "triangle_mesh.h"
 
 // Struct that holds all custom settings
 struct CustomSettings {
@@ -43,6 +50,7 @@ struct CustomSettings {
     std::optional<double> focusDist;
     std::optional<int> numSpheres;
     std::optional<int> numQuads;
+    std::optional<std::string> accelerator;  // "bvh", "grid" or "auto"
     std::optional<std::string> response;
 };
 
@@ -76,13 +84,11 @@ std::atomic<int> rendering_progress(0);
 std::vector<unsigned char> rendered_image;
 std::mutex image_mutex;
 
-void bouncing_spheres() {
+scene bouncing_spheres() {
     hittable_list world;
     
     auto checker = make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9));
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(checker)));
-    
-    auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    world.add(make_shared<plane>(point3(0,0,0), vec3(0,1,0), make_shared<lambertian>(checker)));
 
     for (int a = -11; a < 11; a++) {
         for (int b = -11; b < 11; b++) {
@@ -121,8 +127,6 @@ void bouncing_spheres() {
 
     auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
     world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
-    
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
 
 
 
@@ -142,13 +146,10 @@ void bouncing_spheres() {
     cam.defocus_angle = 0.6;
     cam.focus_dist    = 10.0;
 
-    cam.render(world, [](int progress) {
-        rendering_progress.store(progress);
-    });
-
+    return scene{world, cam};
 }
 
-void checkered_spheres() {
+scene checkered_spheres() {
     hittable_list world;
 
     auto checker = make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9));
@@ -171,12 +172,10 @@ void checkered_spheres() {
 
     cam.defocus_angle = 0;
 
-    cam.render(world, [](int progress) {
-        rendering_progress.store(progress);
-    });
+    return scene{world, cam};
 }
 
-void earth() {
+scene earth() {
     auto earth_texture = make_shared<image_texture>("earthmap.jpg");
     auto earth_surface = make_shared<lambertian>(earth_texture);
     auto globe = make_shared<sphere>(point3(0,0,0), 2, earth_surface);
@@ -196,21 +195,14 @@ void earth() {
 
     cam.defocus_angle = 0;
 
-    cam.render(hittable_list(globe), [](int progress) {
-        rendering_progress.store(progress);
-    });
-    
-    // Store the rendered image
-    std::lock_guard<std::mutex> lock(image_mutex);
-    rendered_image = cam.image_buffer;
-
+    return scene{hittable_list(globe), cam};
 }
 
-void perlin_spheres() {
+scene perlin_spheres() {
     hittable_list world;
 
     auto pertext = make_shared<noise_texture>(4);
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(pertext)));
+    world.add(make_shared<plane>(point3(0,0,0), vec3(0,1,0), make_shared<lambertian>(pertext)));
     world.add(make_shared<sphere>(point3(0,2,0), 2, make_shared<lambertian>(pertext)));
 
     camera cam;
@@ -228,16 +220,10 @@ void perlin_spheres() {
 
     cam.defocus_angle = 0;
 
-    cam.render(world, [](int progress) {
-        rendering_progress.store(progress);
-    });
-    
-    // Store the rendered image
-    std::lock_guard<std::mutex> lock(image_mutex);
-    rendered_image = cam.image_buffer;
+    return scene{world, cam};
 }
 
-void quads() {
+scene quads() {
     hittable_list world;
 
     // Materials
@@ -269,20 +255,14 @@ void quads() {
 
     cam.defocus_angle = 0;
 
-    cam.render(world, [](int progress) {
-        rendering_progress.store(progress);
-    });
-    
-    // Store the rendered image
-    std::lock_guard<std::mutex> lock(image_mutex);
-    rendered_image = cam.image_buffer;
+    return scene{world, cam};
 }
 
-void simple_light() {
+scene simple_light() {
     hittable_list world;
 
     auto pertext = make_shared<noise_texture>(4);
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(pertext)));
+    world.add(make_shared<plane>(point3(0,0,0), vec3(0,1,0), make_shared<lambertian>(pertext)));
     world.add(make_shared<sphere>(point3(0,2,0), 2, make_shared<lambertian>(pertext)));
 
     auto difflight = make_shared<diffuse_light>(color(4,4,4));
@@ -304,16 +284,10 @@ void simple_light() {
 
     cam.defocus_angle = 0;
 
-    cam.render(world, [](int progress) {
-        rendering_progress.store(progress);
-    });
-    
-    // Store the rendered image
-    std::lock_guard<std::mutex> lock(image_mutex);
-    rendered_image = cam.image_buffer;
+    return scene{world, cam};
 }
 
-void cornell_box() {
+scene cornell_box() {
     hittable_list world;
 
     auto red   = make_shared<lambertian>(color(.65, .05, .05));
@@ -343,16 +317,152 @@ void cornell_box() {
 
     cam.defocus_angle = 0;
 
-    cam.render(world, [](int progress) {
-        rendering_progress.store(progress);
-    });
-    
-    // Store the rendered image
-    std::lock_guard<std::mutex> lock(image_mutex);
-    rendered_image = cam.image_buffer;
+    return scene{world, cam};
+}
+
+shared_ptr<triangle_mesh> tessellated_sphere(
+    const point3& center, double radius, int rings, shared_ptr<material> mat
+) {
+    // A closed sphere of 2 * rings * (rings - 1) triangles: `rings` bands of latitude split into
+    // 2 * rings slices, with one vertex at each pole.
+    int slices = 2 * rings;
+    std::vector<point3> positions;
+    std::vector<vec3> normals;
+    std::vector<texture_coord> uvs;
+    std::vector<uint32_t> indices;
+
+    auto add_vertex = [&](const vec3& n, double u, double v) {
+        positions.push_back(center + radius * n);
+        normals.push_back(n);
+        uvs.push_back({real(u), real(v)});
+    };
+
+    add_vertex(vec3(0, 1, 0), 0.5, 1);
+    for (int i = 1; i < rings; i++) {
+        auto theta = pi * i / rings;
+        for (int j = 0; j < slices; j++) {
+            auto phi = 2 * pi * j / slices;
+            add_vertex(vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)),
+                       double(j) / slices, 1 - double(i) / rings);
+        }
+    }
+    add_vertex(vec3(0, -1, 0), 0.5, 0);
+
+    auto top = uint32_t(0);
+    auto bottom = uint32_t(positions.size() - 1);
+    auto vertex = [&](int ring, int slice) { return uint32_t(1 + (ring - 1) * slices + slice % slices); };
+
+    for (int j = 0; j < slices; j++)
+        indices.insert(indices.end(), {top, vertex(1, j + 1), vertex(1, j)});
+    for (int i = 1; i < rings - 1; i++) {
+        for (int j = 0; j < slices; j++) {
+            indices.insert(indices.end(), {vertex(i, j), vertex(i, j + 1), vertex(i + 1, j + 1)});
+            indices.insert(indices.end(), {vertex(i, j), vertex(i + 1, j + 1), vertex(i + 1, j)});
+        }
+    }
+    for (int j = 0; j < slices; j++)
+        indices.insert(indices.end(), {bottom, vertex(rings - 1, j), vertex(rings - 1, j + 1)});
+
+    return make_shared<triangle_mesh>(positions, indices, mat, normals, uvs);
+}
+
+scene triangle_meshes() {
+    hittable_list world;
+
+    auto checker = make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9));
+    world.add(make_shared<quad>(point3(-50,0,-50), vec3(100,0,0), vec3(0,0,100), make_shared<lambertian>(checker)));
+
+    // Three spheres of about 260k triangles each.
+    world.add(tessellated_sphere(point3(-4, 1, 0), 1.0, 256, make_shared<lambertian>(color(0.4, 0.2, 0.1))));
+    world.add(tessellated_sphere(point3( 0, 1, 0), 1.0, 256, make_shared<dielectric>(1.5)));
+    world.add(tessellated_sphere(point3( 4, 1, 0), 1.0, 256, make_shared<metal>(color(0.7, 0.6, 0.5), 0.0)));
+
+    camera cam;
+
+    cam.aspect_ratio      = 16.0 / 9.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 20;
+    cam.max_depth         = 20;
+    cam.background        = color(0.70, 0.80, 1.00);
+
+    cam.vfov     = 20;
+    cam.lookfrom = point3(13,2,3);
+    cam.lookat   = point3(0,1,0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    return scene{world, cam};
 }
 
-void custom_scene(const CustomSettings& settings) {
+scene instanced_meshes() {
+    hittable_list world;
+
+    auto checker = make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9));
+    world.add(make_shared<quad>(point3(-50,0,-50), vec3(100,0,0), vec3(0,0,100), make_shared<lambertian>(checker)));
+
+    // Two shared objects, each built once: a sphere mesh and a box under its own BVH.
+    auto ball = tessellated_sphere(point3(0, 0, 0), 0.25, 48, make_shared<lambertian>(color(0.4, 0.2, 0.1)));
+    auto crate = make_shared<linear_bvh>(*box(point3(-0.2, -0.2, -0.2), point3(0.2, 0.2, 0.2),
+                                              make_shared<metal>(color(0.7, 0.6, 0.5), 0.1)));
+
+    for (int a = -15; a < 15; a++) {
+        for (int b = -15; b < 15; b++) {
+            auto scale = random_double(0.6, 1.2);
+            auto placement = transform::translation(vec3(a + 0.9*random_double(), 0.25*scale, b + 0.9*random_double()))
+                           * transform::rotation(vec3(0, 1, 0), random_double(0, 360))
+                           * transform::scaling(scale);
+            world.add(make_shared<instance>((a + b) % 2 ? shared_ptr<hittable>(ball) : crate, placement));
+        }
+    }
+
+    camera cam;
+
+    cam.aspect_ratio      = 16.0 / 9.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 20;
+    cam.max_depth         = 20;
+    cam.background        = color(0.70, 0.80, 1.00);
+
+    cam.vfov     = 20;
+    cam.lookfrom = point3(13,2,3);
+    cam.lookat   = point3(0,0,0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    return scene{world, cam};
+}
+
+scene uniform_spheres() {
+    // Many small spheres spread evenly through a cube, the kind of world a uniform grid suits.
+    hittable_list world;
+
+    for (int i = 0; i < 20000; i++) {
+        auto center = point3(random_double(-5, 5), random_double(-5, 5), random_double(-5, 5));
+        auto albedo = color::random() * color::random();
+        world.add(make_shared<sphere>(center, random_double(0.02, 0.1), make_shared<lambertian>(albedo)));
+    }
+
+    camera cam;
+
+    cam.aspect_ratio      = 1.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 20;
+    cam.max_depth         = 20;
+    cam.background        = color(0.70, 0.80, 1.00);
+
+    cam.vfov     = 40;
+    cam.lookfrom = point3(0,0,20);
+    cam.lookat   = point3(0,0,0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    return scene{world, cam};
+}
+
+scene custom_scene(const CustomSettings& settings) {
     hittable_list world;
 
     auto numSpheres = settings.numSpheres.value_or(0);
@@ -396,10 +506,7 @@ void custom_scene(const CustomSettings& settings) {
     cam.defocus_angle = settings.defocusAngle.value_or(0);
     cam.focus_dist = settings.focusDist.value_or(10);
 
-    cam.render(world, [](int progress) {
-        rendering_progress.store(progress);
-    });
-    
+    return scene{world, cam};
 }
 
 std::string clean_code(const std::string& raw_code) {
@@ -428,7 +535,7 @@ void save_and_run_code(const std::string& code) {
     out.close();
     
     // Compile
-    std::string compile_cmd = "g++ -std=c++11 -o temp_program " + temp_file;
+    std::string compile_cmd = "g++ -std=c++20 -pthread -o temp_program " + temp_file;
     int compile_result = system(compile_cmd.c_str());
     if (compile_result != 0) {
         std::cerr << "Compilation failed" << std::endl;
@@ -444,33 +551,122 @@ void save_and_run_code(const std::string& code) {
 }
 
 void render_scene(const CustomSettings& settings) {
+    scene selected;
+
     if (settings.prompt == "bouncing_spheres") {
-        bouncing_spheres();
+        selected = bouncing_spheres();
     } else if (settings.prompt == "checkered_spheres") {
-        checkered_spheres();
+        selected = checkered_spheres();
     } else if (settings.prompt == "earth") {
-        earth();
+        selected = earth();
     } else if (settings.prompt == "perlin_spheres") {
-        perlin_spheres();
+        selected = perlin_spheres();
     } else if (settings.prompt == "quads") {
-        quads();
+        selected = quads();
     } else if (settings.prompt == "simple_light") {
-        simple_light();
+        selected = simple_light();
     } else if (settings.prompt == "cornell_box") {
-        cornell_box();
+        selected = cornell_box();
+    } else if (settings.prompt == "triangle_meshes") {
+        selected = triangle_meshes();
+    } else if (settings.prompt == "instanced_meshes") {
+        selected = instanced_meshes();
+    } else if (settings.prompt == "uniform_spheres") {
+        selected = uniform_spheres();
     } else if (settings.prompt == "custom") {
-        custom_scene(settings);
+        selected = custom_scene(settings);
     } else if (settings.prompt == "custom_ai") {
         std::string cleaned_code = clean_code(settings.response.value());
         save_and_run_code(cleaned_code);
+        rendering_progress.store(100);
+        return;
     } else {
         throw std::invalid_argument("Invalid drawing option");
     }
-    
+
+    if (settings.accelerator == "bvh")
+        selected.cam.accelerator = accelerator_choice::bvh;
+    else if (settings.accelerator == "grid")
+        selected.cam.accelerator = accelerator_choice::grid;
+
+    selected.cam.render(selected.world, [](int progress) {
+        rendering_progress.store(progress);
+    });
+
+    // Store the rendered image
+    {
+        std::lock_guard<std::mutex> lock(image_mutex);
+        rendered_image = selected.cam.image_buffer;
+    }
+
     rendering_progress.store(100);
 }
 
-int main() {
+scene mesh_scene(const std::string& path) {
+    // A loaded mesh under a sky, seen from the front of its bounding box.
+    hittable_list world;
+    auto mesh = mesh_loader::load(path, make_shared<lambertian>(color(0.73, 0.73, 0.73)));
+    if (mesh)
+        world.add(mesh);
+
+    auto box = world.bounding_box();
+    auto center = mesh ? box.centroid() : point3(0, 0, 0);
+    auto extent = mesh ? std::max({box.x.size(), box.y.size(), box.z.size()}) : 1.0;
+
+    camera cam;
+
+    cam.aspect_ratio      = 1.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 20;
+    cam.max_depth         = 20;
+    cam.background        = color(0.70, 0.80, 1.00);
+
+    cam.vfov     = 40;
+    cam.lookfrom = center + vec3(0, 0, 2 * extent);
+    cam.lookat   = center;
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    return scene{world, cam};
+}
+
+void run_benchmarks(const std::vector<std::string>& mesh_paths) {
+    // Times every acceleration structure on each built-in scene, then on a scene for each mesh
+    // file given. The custom scene uses enough random spheres and quads to show how the
+    // structures scale.
+    CustomSettings custom;
+    custom.numSpheres = 5000;
+    custom.numQuads = 500;
+    custom.lookfrom = std::array<double, 3>{0, 0, 40};
+
+    std::cout << "Precision: " << benchmark_precision << '\n';
+    benchmark_scene("bouncing_spheres", bouncing_spheres());
+    benchmark_scene("checkered_spheres", checkered_spheres());
+    benchmark_scene("earth", earth());
+    benchmark_scene("perlin_spheres", perlin_spheres());
+    benchmark_scene("quads", quads());
+    benchmark_scene("simple_light", simple_light());
+    benchmark_scene("cornell_box", cornell_box());
+    benchmark_scene("triangle_meshes", triangle_meshes());
+    auto instanced = instanced_meshes();
+    benchmark_scene("instanced_meshes", instanced);
+    benchmark_animation("instanced_meshes", instanced);
+    benchmark_scene("uniform_spheres", uniform_spheres());
+    benchmark_scene("custom", custom_scene(custom));
+
+    for (const auto& path : mesh_paths)
+        benchmark_scene(path.substr(path.find_last_of("/\\") + 1), mesh_scene(path));
+}
+
+int main(int argc, char* argv[]) {
+    // `rAItracing --benchmark [mesh.obj|mesh.ply ...]` measures the acceleration structures
+    // instead of starting the server.
+    if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+        run_benchmarks(std::vector<std::string>(argv + 2, argv + argc));
+        return 0;
+    }
+
     crow::SimpleApp app;
 
     CROW_ROUTE(app, "/")([](){
@@ -985,6 +1181,7 @@ int main() {
             if (custom.has("focusDist")) settings.focusDist = custom["focusDist"].d();
             if (custom.has("numSpheres")) settings.numSpheres = custom["numSpheres"].i();
             if (custom.has("numQuads")) settings.numQuads = custom["numQuads"].i();
+            if (custom.has("accelerator")) settings.accelerator = std::string(custom["accelerator"].s());
         }
 
         // Start the rendering in a separate thread
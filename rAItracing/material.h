@@ -13,7 +13,7 @@ class material {
   public:
     virtual ~material() = default;
     
-    virtual color emitted(double u, double v, const point3& p) const {
+    virtual color emitted(real u, real v, const point3& p) const {
         return color(0,0,0);
     }
 
@@ -22,6 +22,11 @@ class material {
     ) const {
         return false;
     }
+
+    // Whether emitted() and scatter() can ever contribute, so renderers may skip the calls.
+    // Both default to true, which is always safe.
+    virtual bool emits() const { return true; }
+    virtual bool scatters() const { return true; }
 };
 
 class lambertian : public material {
@@ -42,13 +47,15 @@ class lambertian : public material {
         return true;
     }
 
+    bool emits() const override { return false; }
+
   private:
     shared_ptr<texture> tex;
 };
 
 class metal : public material {
   public:
-    metal(const color& albedo, double fuzz) : albedo(albedo), fuzz(fuzz < 1 ? fuzz : 1) {}
+    metal(const color& albedo, real fuzz) : albedo(albedo), fuzz(fuzz < 1 ? fuzz : 1) {}
 
     bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
     const override {
@@ -59,23 +66,25 @@ class metal : public material {
         return (dot(scattered.direction(), rec.normal) > 0);
     }
 
+    bool emits() const override { return false; }
+
   private:
     color albedo;
-    double fuzz;
+    real fuzz;
 };
 
 class dielectric : public material {
   public:
-    dielectric(double refraction_index) : refraction_index(refraction_index) {}
+    dielectric(real refraction_index) : refraction_index(refraction_index) {}
 
     bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
     const override {
         attenuation = color(1.0, 1.0, 1.0);
-        double ri = rec.front_face ? (1.0/refraction_index) : refraction_index;
+        real ri = rec.front_face ? (1.0/refraction_index) : refraction_index;
 
         vec3 unit_direction = unit_vector(r_in.direction());
-        double cos_theta = std::fmin(dot(-unit_direction, rec.normal), 1.0);
-        double sin_theta = std::sqrt(1.0 - cos_theta*cos_theta);
+        real cos_theta = std::fmin(dot(-unit_direction, rec.normal), 1.0);
+        real sin_theta = std::sqrt(1.0 - cos_theta*cos_theta);
 
         bool cannot_refract = ri * sin_theta > 1.0;
         vec3 direction;
@@ -89,12 +98,14 @@ class dielectric : public material {
         return true;
     }
 
+    bool emits() const override { return false; }
+
   private:
     // Refractive index in vacuum or air, or the ratio of the material's refractive index over
     // the refractive index of the enclosing media
-    double refraction_index;
+    real refraction_index;
     
-    static double reflectance(double cosine, double refraction_index) {
+    static real reflectance(real cosine, real refraction_index) {
         // Use Schlick's approximation for reflectance.
         auto r0 = (1 - refraction_index) / (1 + refraction_index);
         r0 = r0*r0;
@@ -107,10 +118,12 @@ class diffuse_light : public material {
     diffuse_light(shared_ptr<texture> tex) : tex(tex) {}
     diffuse_light(const color& emit) : tex(make_shared<solid_color>(emit)) {}
 
-    color emitted(double u, double v, const point3& p) const override {
+    color emitted(real u, real v, const point3& p) const override {
         return tex->value(u, v, p);
     }
 
+    bool scatters() const override { return false; }
+
   private:
     shared_ptr<texture> tex;
 };
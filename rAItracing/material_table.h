@@ -0,0 +1,127 @@
+//
+//  material_table.h
+//  rAItracing
+//
+
+#ifndef MATERIAL_TABLE_H
+#define MATERIAL_TABLE_H
+
+#include "material.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+struct material_entry {
+    const material* mat = nullptr;
+    bool emits = true;     // Cached material::emits()
+    bool scatters = true;  // Cached material::scatters()
+};
+
+class material_table {
+  // Numbers every material a primitive uses, so a hit record names its material with a 32-bit
+  // index instead of copying a shared_ptr: each copy is an atomic reference count update on a
+  // cache line shared by every render thread. Primitives register their material once, when
+  // they are built, and keep owning it; the table only records the pointer and the flags.
+  // Lookups take no lock, since an entry is written once, before its id is handed out, and
+  // never changed while its material lives.
+  //
+  // The table watches each material through a weak pointer. Once a material is destroyed so
+  // are all primitives that owned it, and no render can still read its entry, so the id is
+  // given to a later material. A server building a scene per request thus keeps the table
+  // at the size of the scenes alive at once.
+  public:
+    uint32_t add(const shared_ptr<material>& mat) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // A material is registered once, however many primitives use it. Its address can come
+        // back for a new material after it was destroyed, which then gets an id of its own.
+        auto it = ids.find(mat.get());
+        auto stale = false;
+        uint32_t stale_id = 0;
+        if (it != ids.end()) {
+            if (!mat || !it->second.owner.expired())
+                return it->second.id;
+            stale = true;
+            stale_id = it->second.id;
+            ids.erase(it);
+        }
+
+        auto id = allocate();
+        if (stale)
+            free_ids.push_back(stale_id);
+        auto& entry = chunks[id >> chunk_bits].load(std::memory_order_relaxed)[id & chunk_mask];
+        entry.mat = mat.get();
+        entry.emits = mat && mat->emits();
+        entry.scatters = mat && mat->scatters();
+        ids.emplace(mat.get(), registration{mat, id});
+        return id;
+    }
+
+    const material_entry& operator[](uint32_t id) const {
+        return chunks[id >> chunk_bits].load(std::memory_order_acquire)[id & chunk_mask];
+    }
+
+    ~material_table() {
+        for (auto& chunk : chunks)
+            delete[] chunk.load();
+    }
+
+  private:
+    static constexpr uint32_t chunk_bits = 12;
+    static constexpr uint32_t chunk_size = 1u << chunk_bits;
+    static constexpr uint32_t chunk_mask = chunk_size - 1;
+    static constexpr uint32_t max_chunks = 4096;  // Room for 16M materials
+
+    struct registration {
+        std::weak_ptr<material> owner;  // Expires when the material is destroyed
+        uint32_t id;
+    };
+
+    std::atomic<material_entry*> chunks[max_chunks] = {};
+    std::unordered_map<const material*, registration> ids;
+    std::vector<uint32_t> free_ids;  // Ids of destroyed materials
+    uint32_t count = 0;              // Ids ever handed out, the next new one
+    std::mutex mutex;
+
+    uint32_t allocate() {
+        // Before opening another chunk, takes back the ids of materials destroyed since the
+        // last sweep. The null material is never released.
+        if (free_ids.empty() && (count & chunk_mask) == 0) {
+            for (auto it = ids.begin(); it != ids.end(); ) {
+                if (it->first && it->second.owner.expired()) {
+                    free_ids.push_back(it->second.id);
+                    it = ids.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+
+        if (!free_ids.empty()) {
+            auto id = free_ids.back();
+            free_ids.pop_back();
+            return id;
+        }
+
+        if (count == max_chunks * chunk_size)
+            throw std::length_error("material_table: more than 16M materials alive at once");
+
+        auto& chunk = chunks[count >> chunk_bits];
+        if (!chunk.load(std::memory_order_relaxed))
+            chunk.store(new material_entry[chunk_size], std::memory_order_release);
+        return count++;
+    }
+};
+
+inline material_table& global_materials() {
+    // The materials of every scene built by this process.
+    static material_table table;
+    return table;
+}
+
+#endif
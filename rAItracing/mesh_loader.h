@@ -0,0 +1,805 @@
+//
+//  mesh_loader.h
+//  rAItracing
+//
+
+#ifndef MESH_LOADER_H
+#define MESH_LOADER_H
+
+#include "thread_pool.h"
+#include "triangle_mesh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+    #define RT_HAVE_MMAP 1
+#endif
+
+class mapped_file {
+  // A whole file mapped read-only into memory, or read into a buffer where mmap is unavailable.
+  public:
+    explicit mapped_file(const std::string& path) {
+#if RT_HAVE_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat info;
+        if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+            auto size = size_t(info.st_size);
+            void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping != MAP_FAILED) {
+                ::madvise(mapping, size, MADV_SEQUENTIAL);
+                bytes = static_cast<const char*>(mapping);
+                length = size;
+                mapped = true;
+            }
+        }
+        ::close(fd);
+        if (mapped)
+            return;
+#endif
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        if (!in)
+            return;
+        buffer.resize(size_t(in.tellg()));
+        in.seekg(0);
+        in.read(buffer.data(), std::streamsize(buffer.size()));
+        bytes = buffer.data();
+        length = buffer.size();
+        opened = bool(in);
+    }
+
+    ~mapped_file() {
+#if RT_HAVE_MMAP
+        if (mapped)
+            ::munmap(const_cast<char*>(bytes), length);
+#endif
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    bool is_open() const { return mapped || opened; }
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+  private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+    bool mapped = false;
+    bool opened = false;
+    std::vector<char> buffer;
+};
+
+struct mesh_load_stats {
+    size_t bytes = 0;
+    size_t vertices = 0;
+    size_t triangles = 0;
+    double parse_seconds = 0;  // Mapping and parsing the file into the mesh buffers
+    double build_seconds = 0;  // Building the mesh and its BVH
+
+    double megabytes_per_second() const {
+        return parse_seconds > 0 ? bytes / 1048576.0 / parse_seconds : 0;
+    }
+
+    double triangles_per_second() const {
+        return parse_seconds > 0 ? triangles / parse_seconds : 0;
+    }
+};
+
+inline std::ostream& operator<<(std::ostream& out, const mesh_load_stats& stats) {
+    return out << stats.vertices << " vertices, " << stats.triangles << " triangles, "
+               << stats.bytes / 1048576.0 << " MB parsed in " << 1000 * stats.parse_seconds
+               << " ms (" << stats.megabytes_per_second() << " MB/s, "
+               << stats.triangles_per_second() / 1e6 << " Mtriangles/s), mesh built in "
+               << 1000 * stats.build_seconds << " ms";
+}
+
+class mesh_loader {
+  // Loads Wavefront OBJ and binary PLY files into a triangle_mesh. The file is memory-mapped and
+  // parsed straight into the mesh's flat buffers: a first parallel pass counts the vertices and
+  // triangles of each chunk of the file, which gives every chunk its place in the buffers, and a
+  // second parallel pass parses the chunks into those places. Polygons are split into fans of
+  // triangles. OBJ normals and texture coordinates are kept only when they are indexed like the
+  // positions, since the mesh has one index per corner; otherwise face normals are used.
+  public:
+    static shared_ptr<triangle_mesh> load(
+        const std::string& path, shared_ptr<material> mat, mesh_load_stats* stats = nullptr,
+        int thread_count = 0
+    ) {
+        using clock = std::chrono::steady_clock;
+        auto start = clock::now();
+
+        mapped_file file(path);
+        if (!file.is_open()) {
+            std::cerr << "mesh_loader: could not open " << path << '\n';
+            return nullptr;
+        }
+
+        std::unique_ptr<thread_pool> pool;
+        if (thread_count != 1 && file.size() >= parallel_threshold)
+            pool = std::make_unique<thread_pool>(thread_count);
+
+        buffers mesh;
+        std::string error;
+        auto extension = path.substr(std::min(path.size(), path.find_last_of('.') + 1));
+        std::transform(extension.begin(), extension.end(), extension.begin(),
+                       [](unsigned char c) { return char(std::tolower(c)); });
+
+        bool parsed;
+        if (extension == "obj")
+            parsed = parse_obj(file.data(), file.size(), mesh, pool.get(), error);
+        else if (extension == "ply")
+            parsed = parse_ply(file.data(), file.size(), mesh, pool.get(), error);
+        else {
+            parsed = false;
+            error = "unknown mesh format ." + extension;
+        }
+        if (!parsed) {
+            std::cerr << "mesh_loader: " << path << ": " << error << '\n';
+            return nullptr;
+        }
+
+        mesh_load_stats result;
+        result.bytes = file.size();
+        result.vertices = mesh.positions.size();
+        result.triangles = mesh.indices.size() / 3;
+        auto parsed_at = clock::now();
+        result.parse_seconds = std::chrono::duration<double>(parsed_at - start).count();
+
+        bvh_build_options options;
+        options.thread_count = thread_count;
+        auto result_mesh = make_shared<triangle_mesh>(
+            std::move(mesh.positions), std::move(mesh.indices), mat, std::move(mesh.normals),
+            std::move(mesh.uvs), options);
+        result.build_seconds = std::chrono::duration<double>(clock::now() - parsed_at).count();
+
+        std::clog << "Loaded " << path << ": " << result << '\n';
+        if (stats)
+            *stats = result;
+        return result_mesh;
+    }
+
+  private:
+    static constexpr size_t parallel_threshold = 1 << 20;  // Smaller files are parsed serially
+    static constexpr size_t obj_chunk_size = 1 << 20;      // Bytes of OBJ text per task
+    static constexpr size_t ply_chunk_size = 1 << 16;      // PLY elements per task
+    static constexpr uint32_t invalid_index = ~0u;         // Dropped by triangle_mesh
+
+    struct buffers {
+        std::vector<point3> positions;
+        std::vector<vec3> normals;
+        std::vector<texture_coord> uvs;
+        std::vector<uint32_t> indices;
+    };
+
+    template <typename Body>
+    static void for_each_chunk(thread_pool* pool, size_t count, const Body& body) {
+        if (pool && count > 1)
+            pool->parallel_for(count, body);
+        else
+            for (size_t k = 0; k < count; k++)
+                body(k);
+    }
+
+    // Text scanning
+
+    static bool is_blank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+    static const char* skip_blanks(const char* p, const char* end) {
+        while (p < end && is_blank(*p))
+            p++;
+        return p;
+    }
+
+    static const char* end_of_line(const char* p, const char* end) {
+        auto newline = static_cast<const char*>(std::memchr(p, '\n', size_t(end - p)));
+        return newline ? newline : end;
+    }
+
+    static bool parse_integer(const char*& p, const char* end, long long& value) {
+        bool negative = p < end && *p == '-';
+        if (p < end && (*p == '-' || *p == '+'))
+            p++;
+        if (p == end || *p < '0' || *p > '9')
+            return false;
+        // Long digit runs saturate rather than overflow: no index is that large, and an exponent
+        // is clamped anyway.
+        constexpr long long saturated = (std::numeric_limits<long long>::max() - 9) / 10;
+        long long result = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; p++) {
+            if (result <= saturated)
+                result = result * 10 + (*p - '0');
+        }
+        value = negative ? -result : result;
+        return true;
+    }
+
+    static bool parse_real(const char*& p, const char* end, real& value) {
+        // Decimal with optional fraction and exponent. Up to 19 significant digits are kept,
+        // which is exact for every value a float or double vertex coordinate prints as.
+        static const double exact_powers[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+
+        bool negative = p < end && *p == '-';
+        if (p < end && (*p == '-' || *p == '+'))
+            p++;
+
+        uint64_t mantissa = 0;
+        int digits = 0, exponent = 0;
+        bool any = false;
+        for (; p < end && *p >= '0' && *p <= '9'; p++, any = true) {
+            if (digits < 19) { mantissa = mantissa * 10 + uint64_t(*p - '0'); if (mantissa) digits++; }
+            else exponent++;
+        }
+        if (p < end && *p == '.') {
+            for (p++; p < end && *p >= '0' && *p <= '9'; p++, any = true) {
+                if (digits < 19) { mantissa = mantissa * 10 + uint64_t(*p - '0'); if (mantissa) digits++; exponent--; }
+            }
+        }
+        if (!any)
+            return false;
+        if (p < end && (*p == 'e' || *p == 'E')) {
+            long long e;
+            p++;
+            if (!parse_integer(p, end, e))
+                return false;
+            exponent += int(std::clamp(e, -10000LL, 10000LL));
+        }
+
+        double result = double(mantissa);
+        if (mantissa < (1ull << 53) && exponent >= -22 && exponent <= 22)
+            result = exponent < 0 ? result / exact_powers[-exponent] : result * exact_powers[exponent];
+        else if (mantissa != 0)
+            result *= std::pow(10.0, exponent);
+        value = real(negative ? -result : result);
+        return true;
+    }
+
+    // Wavefront OBJ
+
+    struct obj_counts {
+        size_t positions = 0, uvs = 0, normals = 0, triangles = 0;
+    };
+
+    enum obj_line { obj_other, obj_position, obj_uv, obj_normal, obj_face };
+
+    static obj_line classify(const char*& p, const char* end) {
+        // Reads the keyword of a line and leaves p after it.
+        p = skip_blanks(p, end);
+        if (p == end)
+            return obj_other;
+        auto keyword = p;
+        while (p < end && !is_blank(*p) && *p != '\n')
+            p++;
+        auto length = p - keyword;
+        if (length == 1 && keyword[0] == 'v') return obj_position;
+        if (length == 1 && keyword[0] == 'f') return obj_face;
+        if (length == 2 && keyword[0] == 'v' && keyword[1] == 't') return obj_uv;
+        if (length == 2 && keyword[0] == 'v' && keyword[1] == 'n') return obj_normal;
+        return obj_other;
+    }
+
+    static int count_corners(const char* p, const char* end) {
+        int corners = 0;
+        while (true) {
+            p = skip_blanks(p, end);
+            if (p == end || *p == '#')
+                return corners;
+            corners++;
+            while (p < end && !is_blank(*p) && *p != '#')
+                p++;
+        }
+    }
+
+    static std::vector<size_t> obj_chunk_starts(const char* data, size_t size) {
+        // Chunk boundaries at line starts, one chunk per obj_chunk_size bytes of text.
+        std::vector<size_t> starts{0};
+        for (size_t at = obj_chunk_size; at < size; at += obj_chunk_size) {
+            auto line = end_of_line(data + at, data + size);
+            auto next = size_t(line - data) + 1;
+            if (next >= size)
+                break;
+            if (next > starts.back())
+                starts.push_back(next);
+            at = next;
+        }
+        starts.push_back(size);
+        return starts;
+    }
+
+    static bool parse_obj(const char* data, size_t size, buffers& out, thread_pool* pool, std::string& error) {
+        auto starts = obj_chunk_starts(data, size);
+        auto chunks = starts.size() - 1;
+
+        // Pass 1: count what each chunk adds to the buffers.
+        std::vector<obj_counts> counts(chunks);
+        for_each_chunk(pool, chunks, [&](size_t chunk) {
+            auto& c = counts[chunk];
+            const char* end = data + starts[chunk + 1];
+            for (const char* p = data + starts[chunk]; p < end; ) {
+                auto line_end = end_of_line(p, end);
+                switch (classify(p, line_end)) {
+                    case obj_position: c.positions++; break;
+                    case obj_uv:       c.uvs++; break;
+                    case obj_normal:   c.normals++; break;
+                    case obj_face:     c.triangles += size_t(std::max(0, count_corners(p, line_end) - 2)); break;
+                    default:           break;
+                }
+                p = line_end + 1;
+            }
+        });
+
+        // Turn the counts into each chunk's first slot in the buffers.
+        obj_counts total;
+        std::vector<obj_counts> bases(chunks);
+        for (size_t chunk = 0; chunk < chunks; chunk++) {
+            bases[chunk] = total;
+            total.positions += counts[chunk].positions;
+            total.uvs += counts[chunk].uvs;
+            total.normals += counts[chunk].normals;
+            total.triangles += counts[chunk].triangles;
+        }
+        if (total.positions >= invalid_index) {
+            error = "too many vertices for 32-bit indices";
+            return false;
+        }
+
+        out.positions.resize(total.positions);
+        out.uvs.resize(total.uvs);
+        out.normals.resize(total.normals);
+        out.indices.resize(3 * total.triangles);
+
+        // Pass 2: parse every chunk into its slots.
+        std::atomic<bool> malformed{false}, uvs_match{true}, normals_match{true};
+        for_each_chunk(pool, chunks, [&](size_t chunk) {
+            auto at = bases[chunk];
+            uint32_t* index_out = out.indices.data() + 3 * at.triangles;
+            bool chunk_uvs_match = true, chunk_normals_match = true;
+            std::vector<uint32_t> corners;
+
+            const char* end = data + starts[chunk + 1];
+            for (const char* p = data + starts[chunk]; p < end; ) {
+                auto line_end = end_of_line(p, end);
+                auto kind = classify(p, line_end);
+
+                if (kind == obj_position || kind == obj_normal || kind == obj_uv) {
+                    real xyz[3] = {0, 0, 0};
+                    int needed = (kind == obj_uv) ? 2 : 3;
+                    for (int k = 0; k < needed; k++) {
+                        p = skip_blanks(p, line_end);
+                        if (!parse_real(p, line_end, xyz[k]) && !(kind == obj_uv && k == 1))
+                            malformed = true;
+                    }
+                    if (kind == obj_position)
+                        out.positions[at.positions++] = point3(xyz[0], xyz[1], xyz[2]);
+                    else if (kind == obj_normal)
+                        out.normals[at.normals++] = vec3(xyz[0], xyz[1], xyz[2]);
+                    else
+                        out.uvs[at.uvs++] = {xyz[0], xyz[1]};
+                } else if (kind == obj_face) {
+                    // Corners are v, v/vt, v//vn or v/vt/vn, with negative indices counting back
+                    // from the latest vertex.
+                    corners.clear();
+                    while (true) {
+                        p = skip_blanks(p, line_end);
+                        if (p == line_end || *p == '#')
+                            break;
+                        long long v = 0, t = 0, n = 0;
+                        bool ok = parse_integer(p, line_end, v);
+                        if (p < line_end && *p == '/') {
+                            p++;
+                            if (p < line_end && *p != '/')
+                                ok = parse_integer(p, line_end, t) && ok;
+                            if (p < line_end && *p == '/') {
+                                p++;
+                                ok = parse_integer(p, line_end, n) && ok;
+                            }
+                        }
+                        while (p < line_end && !is_blank(*p) && *p != '#')
+                            p++;
+
+                        auto vi = resolve(v, at.positions, total.positions);
+                        if (!ok || vi == invalid_index)
+                            malformed = true;
+                        if (t != 0 && resolve(t, at.uvs, total.uvs) != vi)
+                            chunk_uvs_match = false;
+                        if (t == 0)
+                            chunk_uvs_match = false;
+                        if (n != 0 && resolve(n, at.normals, total.normals) != vi)
+                            chunk_normals_match = false;
+                        if (n == 0)
+                            chunk_normals_match = false;
+                        corners.push_back(vi);
+                    }
+
+                    for (size_t k = 2; k < corners.size(); k++) {
+                        *index_out++ = corners[0];
+                        *index_out++ = corners[k - 1];
+                        *index_out++ = corners[k];
+                    }
+                    at.triangles += corners.size() >= 3 ? corners.size() - 2 : 0;
+                }
+                p = line_end + 1;
+            }
+
+            if (!chunk_uvs_match) uvs_match = false;
+            if (!chunk_normals_match) normals_match = false;
+        });
+
+        if (malformed)
+            std::cerr << "mesh_loader: skipped malformed OBJ values\n";
+        if (!uvs_match || out.uvs.size() != out.positions.size())
+            out.uvs.clear();
+        if (!normals_match || out.normals.size() != out.positions.size())
+            out.normals.clear();
+        return true;
+    }
+
+    static uint32_t resolve(long long index, size_t defined, size_t total) {
+        // OBJ indices start at 1; negative ones are relative to the `defined` vertices so far.
+        long long zero_based = index > 0 ? index - 1 : (long long)defined + index;
+        return (index != 0 && zero_based >= 0 && size_t(zero_based) < total) ? uint32_t(zero_based)
+                                                                           : invalid_index;
+    }
+
+    // Binary PLY
+
+    enum ply_type { ply_int8, ply_uint8, ply_int16, ply_uint16, ply_int32, ply_uint32, ply_float32, ply_float64 };
+
+    struct ply_property {
+        std::string name;
+        ply_type type = ply_float32;
+        bool is_list = false;
+        ply_type count_type = ply_uint8;  // Lists only: type of the length prefix
+    };
+
+    struct ply_element {
+        std::string name;
+        size_t count = 0;
+        std::vector<ply_property> properties;
+
+        size_t fixed_size() const {
+            // Bytes per element, or 0 if the element holds a list.
+            size_t bytes = 0;
+            for (const auto& property : properties) {
+                if (property.is_list)
+                    return 0;
+                bytes += type_size(property.type);
+            }
+            return bytes;
+        }
+    };
+
+    static size_t type_size(ply_type type) {
+        static const size_t sizes[] = {1, 1, 2, 2, 4, 4, 4, 8};
+        return sizes[type];
+    }
+
+    static bool parse_type(const std::string& name, ply_type& type) {
+        static const std::pair<const char*, ply_type> names[] = {
+            {"char", ply_int8}, {"int8", ply_int8}, {"uchar", ply_uint8}, {"uint8", ply_uint8},
+            {"short", ply_int16}, {"int16", ply_int16}, {"ushort", ply_uint16}, {"uint16", ply_uint16},
+            {"int", ply_int32}, {"int32", ply_int32}, {"uint", ply_uint32}, {"uint32", ply_uint32},
+            {"float", ply_float32}, {"float32", ply_float32}, {"double", ply_float64}, {"float64", ply_float64}
+        };
+        for (const auto& [text, value] : names) {
+            if (name == text) {
+                type = value;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    template <typename T>
+    static T load_scalar(const char* p, bool swap) {
+        unsigned char bytes[sizeof(T)];
+        std::memcpy(bytes, p, sizeof(T));
+        if (swap)
+            std::reverse(bytes, bytes + sizeof(T));
+        T value;
+        std::memcpy(&value, bytes, sizeof(T));
+        return value;
+    }
+
+    static double read_scalar(const char* p, ply_type type, bool swap) {
+        switch (type) {
+            case ply_int8:    return double(load_scalar<int8_t>(p, swap));
+            case ply_uint8:   return double(load_scalar<uint8_t>(p, swap));
+            case ply_int16:   return double(load_scalar<int16_t>(p, swap));
+            case ply_uint16:  return double(load_scalar<uint16_t>(p, swap));
+            case ply_int32:   return double(load_scalar<int32_t>(p, swap));
+            case ply_uint32:  return double(load_scalar<uint32_t>(p, swap));
+            case ply_float32: return double(load_scalar<float>(p, swap));
+            default:          return load_scalar<double>(p, swap);
+        }
+    }
+
+    static bool fits(size_t at, size_t size, size_t count, size_t stride) {
+        // Whether count items of stride bytes starting at `at` lie within size, without the
+        // products that a count read from the file could overflow.
+        return at <= size && (stride == 0 || count <= (size - at) / stride);
+    }
+
+    static bool read_list_count(
+        const char* data, size_t size, size_t& at, const ply_property& property, bool swap, size_t& entries
+    ) {
+        // Reads the length of a list and moves `at` past it. The length must be a whole,
+        // non-negative number of entries that fit in the rest of the file.
+        auto count_size = type_size(property.count_type);
+        if (!fits(at, size, 1, count_size))
+            return false;
+        auto value = read_scalar(data + at, property.count_type, swap);
+        at += count_size;
+        if (!(value >= 0) || value != std::floor(value) || value > double(size - at) / type_size(property.type))
+            return false;
+        entries = size_t(value);
+        return true;
+    }
+
+    static bool skip_lists(
+        const char* data, size_t size, size_t& at, const ply_element& element, size_t count, bool swap
+    ) {
+        // Moves `at` past `count` elements containing lists, checking every step against size.
+        for (size_t i = 0; i < count; i++) {
+            for (const auto& property : element.properties) {
+                size_t entries = 1;
+                if (property.is_list && !read_list_count(data, size, at, property, swap, entries))
+                    return false;
+                if (!fits(at, size, entries, type_size(property.type)))
+                    return false;
+                at += entries * type_size(property.type);
+            }
+        }
+        return true;
+    }
+
+    static bool parse_ply(const char* data, size_t size, buffers& out, thread_pool* pool, std::string& error) {
+        // Header: text lines up to end_header describing the elements that follow.
+        std::vector<ply_element> elements;
+        bool big_endian = false, have_format = false;
+        size_t at = 0;
+        bool magic = true;
+        while (true) {
+            if (at >= size) {
+                error = "missing end_header";
+                return false;
+            }
+            auto line_end = end_of_line(data + at, data + size);
+            std::string line(data + at, line_end);
+            at = size_t(line_end - data) + 1;
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+
+            std::vector<std::string> words;
+            for (size_t i = 0; i < line.size(); ) {
+                while (i < line.size() && line[i] == ' ') i++;
+                auto j = i;
+                while (j < line.size() && line[j] != ' ') j++;
+                if (j > i) words.push_back(line.substr(i, j - i));
+                i = j;
+            }
+
+            if (magic) {
+                if (line != "ply") {
+                    error = "not a PLY file";
+                    return false;
+                }
+                magic = false;
+            } else if (words.empty() || words[0] == "comment" || words[0] == "obj_info") {
+                continue;
+            } else if (words[0] == "format" && words.size() >= 2) {
+                if (words[1] == "ascii") {
+                    error = "ASCII PLY is not supported, only binary";
+                    return false;
+                }
+                big_endian = words[1] == "binary_big_endian";
+                have_format = big_endian || words[1] == "binary_little_endian";
+            } else if (words[0] == "element" && words.size() >= 3) {
+                elements.push_back({words[1], size_t(std::strtoull(words[2].c_str(), nullptr, 10)), {}});
+            } else if (words[0] == "property" && !elements.empty()) {
+                ply_property property;
+                bool ok;
+                if (words.size() >= 5 && words[1] == "list") {
+                    property.is_list = true;
+                    property.name = words[4];
+                    ok = parse_type(words[2], property.count_type) && parse_type(words[3], property.type);
+                } else {
+                    ok = words.size() >= 3 && parse_type(words[1], property.type);
+                    if (ok)
+                        property.name = words[2];
+                }
+                if (!ok) {
+                    error = "unsupported property: " + line;
+                    return false;
+                }
+                elements.back().properties.push_back(property);
+            } else if (words[0] == "end_header") {
+                break;
+            }
+        }
+        if (!have_format) {
+            error = "missing binary format line";
+            return false;
+        }
+        bool swap = big_endian != (std::endian::native == std::endian::big);
+
+        for (const auto& element : elements) {
+            bool ok;
+            if (element.name == "vertex")
+                ok = parse_ply_vertices(data, size, at, element, swap, out, pool);
+            else if (element.name == "face")
+                ok = parse_ply_faces(data, size, at, element, swap, out, pool);
+            else if (auto stride = element.fixed_size())
+                ok = fits(at, size, element.count, stride) && (at += element.count * stride, true);
+            else
+                ok = skip_lists(data, size, at, element, element.count, swap);
+
+            if (!ok) {
+                error = "truncated file or bad list length in element " + element.name;
+                return false;
+            }
+        }
+
+        if (out.positions.size() >= invalid_index) {
+            error = "too many vertices for 32-bit indices";
+            return false;
+        }
+        return true;
+    }
+
+    static bool parse_ply_vertices(
+        const char* data, size_t size, size_t& at, const ply_element& element, bool swap,
+        buffers& out, thread_pool* pool
+    ) {
+        auto stride = element.fixed_size();
+        if (stride == 0 || !fits(at, size, element.count, stride))
+            return false;
+
+        // Byte offset and type of each property the mesh uses, -1 if the file lacks it.
+        struct field { long offset = -1; ply_type type = ply_float32; };
+        field position[3], normal[3], uv[2];
+        size_t offset = 0;
+        for (const auto& property : element.properties) {
+            const auto& n = property.name;
+            field f{long(offset), property.type};
+            if (n == "x") position[0] = f;
+            else if (n == "y") position[1] = f;
+            else if (n == "z") position[2] = f;
+            else if (n == "nx") normal[0] = f;
+            else if (n == "ny") normal[1] = f;
+            else if (n == "nz") normal[2] = f;
+            else if (n == "u" || n == "s" || n == "texture_u") uv[0] = f;
+            else if (n == "v" || n == "t" || n == "texture_v") uv[1] = f;
+            offset += type_size(property.type);
+        }
+        if (position[0].offset < 0 || position[1].offset < 0 || position[2].offset < 0)
+            return false;
+        bool has_normals = normal[0].offset >= 0 && normal[1].offset >= 0 && normal[2].offset >= 0;
+        bool has_uvs = uv[0].offset >= 0 && uv[1].offset >= 0;
+
+        out.positions.resize(element.count);
+        out.normals.resize(has_normals ? element.count : 0);
+        out.uvs.resize(has_uvs ? element.count : 0);
+
+        auto base = data + at;
+        auto read = [&](const char* vertex, const field& f) { return real(read_scalar(vertex + f.offset, f.type, swap)); };
+        for_each_chunk(pool, (element.count + ply_chunk_size - 1) / ply_chunk_size, [&](size_t chunk) {
+            auto last = std::min(element.count, (chunk + 1) * ply_chunk_size);
+            for (size_t i = chunk * ply_chunk_size; i < last; i++) {
+                auto vertex = base + i * stride;
+                out.positions[i] = point3(read(vertex, position[0]), read(vertex, position[1]), read(vertex, position[2]));
+                if (has_normals)
+                    out.normals[i] = vec3(read(vertex, normal[0]), read(vertex, normal[1]), read(vertex, normal[2]));
+                if (has_uvs)
+                    out.uvs[i] = {read(vertex, uv[0]), read(vertex, uv[1])};
+            }
+        });
+
+        at += element.count * stride;
+        return true;
+    }
+
+    static bool parse_ply_faces(
+        const char* data, size_t size, size_t& at, const ply_element& element, bool swap,
+        buffers& out, thread_pool* pool
+    ) {
+        int list = -1;
+        for (size_t k = 0; k < element.properties.size(); k++) {
+            const auto& property = element.properties[k];
+            if (property.is_list && (property.name == "vertex_indices" || property.name == "vertex_index"))
+                list = int(k);
+        }
+        if (list < 0 || !fits(at, size, element.count, 1))
+            return false;
+
+        // Faces have different sizes, so one serial sweep over the list lengths finds where each
+        // chunk of faces starts in the file and in the index buffer.
+        size_t chunks = (element.count + ply_chunk_size - 1) / ply_chunk_size;
+        std::vector<size_t> chunk_at(chunks + 1), chunk_triangles(chunks + 1);
+        size_t triangles = 0;
+        for (size_t chunk = 0; chunk < chunks; chunk++) {
+            chunk_at[chunk] = at;
+            chunk_triangles[chunk] = triangles;
+            auto last = std::min(element.count, (chunk + 1) * ply_chunk_size);
+            for (size_t i = chunk * ply_chunk_size; i < last; i++) {
+                for (size_t k = 0; k < element.properties.size(); k++) {
+                    const auto& property = element.properties[k];
+                    size_t entries = 1;
+                    if (property.is_list) {
+                        if (!read_list_count(data, size, at, property, swap, entries))
+                            return false;
+                        if (int(k) == list && entries >= 3)
+                            triangles += entries - 2;
+                    }
+                    if (!fits(at, size, entries, type_size(property.type)))
+                        return false;
+                    at += entries * type_size(property.type);
+                }
+            }
+        }
+        chunk_at[chunks] = at;
+        chunk_triangles[chunks] = triangles;
+
+        // Every index of a triangle after a face's first two takes at least a byte of the file.
+        if (triangles > size)
+            return false;
+
+        auto vertex_count = out.positions.size();
+        out.indices.resize(3 * triangles);
+        for_each_chunk(pool, chunks, [&](size_t chunk) {
+            size_t p = chunk_at[chunk];
+            uint32_t* index_out = out.indices.data() + 3 * chunk_triangles[chunk];
+            auto last = std::min(element.count, (chunk + 1) * ply_chunk_size);
+
+            for (size_t i = chunk * ply_chunk_size; i < last; i++) {
+                for (size_t k = 0; k < element.properties.size(); k++) {
+                    const auto& property = element.properties[k];
+                    if (!property.is_list) {
+                        p += type_size(property.type);
+                        continue;
+                    }
+                    // The counting sweep has checked every list length.
+                    auto entries = size_t(read_scalar(data + p, property.count_type, swap));
+                    p += type_size(property.count_type);
+                    if (int(k) == list) {
+                        auto index_size = type_size(property.type);
+                        auto corner = [&](size_t c) {
+                            auto value = read_scalar(data + p + c * index_size, property.type, swap);
+                            return (value >= 0 && value < double(vertex_count)) ? uint32_t(value) : invalid_index;
+                        };
+                        for (size_t c = 2; c < entries; c++) {
+                            *index_out++ = corner(0);
+                            *index_out++ = corner(c - 1);
+                            *index_out++ = corner(c);
+                        }
+                    }
+                    p += entries * type_size(property.type);
+                }
+            }
+        });
+
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,230 @@
+//
+//  motion_bvh.h
+//  rAItracing
+//
+
+#ifndef MOTION_BVH_H
+#define MOTION_BVH_H
+
+#include "bvh_build.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+#include "primitive_arrays.h"
+#include "ray_packet.h"
+#include "sphere_pack.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+inline bool has_motion(const hittable_list& world) {
+    // Whether any object's bounds differ between the start and end of the shutter interval.
+    for (const auto& object : world.objects) {
+        auto start = object->bounding_box_at(0);
+        auto end = object->bounding_box_at(1);
+        for (int axis = 0; axis < 3; axis++) {
+            if (start.axis_interval(axis).min != end.axis_interval(axis).min
+                || start.axis_interval(axis).max != end.axis_interval(axis).max)
+                return true;
+        }
+    }
+    return false;
+}
+
+struct motion_bvh_node_motion {
+    // How far the bounds of a node move from time 0 to time 1, and the bounds over the whole
+    // interval, both rounded outward like the bounds themselves.
+    float min_delta[3];
+    float max_delta[3];
+    float sweep_min[3];
+    float sweep_max[3];
+};
+
+class motion_bvh : public hittable {
+  // A BVH for scenes with moving objects. A moving object's bounding_box() spans its whole path,
+  // so in an ordinary BVH every ray pays for the full sweep whatever its time. Here each node
+  // stores its bounds at both ends of the shutter interval and a ray tests the bounds
+  // interpolated to its own time. The interpolation is conservative as long as objects move
+  // linearly, as moving spheres do. The tree is built on the bounds halfway through the
+  // interval.
+  public:
+    motion_bvh(const hittable_list& list, const bvh_build_options& options = {}) {
+        auto tree = linear_bvh_builder(options).build(list.objects.size(), [&](size_t i) {
+            return list.objects[i]->bounding_box_at(0.5);
+        });
+        nodes = std::move(tree.nodes);
+
+        objects.reserve(tree.order.size());
+        for (auto index : tree.order)
+            objects.push_back(list.objects[index]);
+        primitives = make_shared<primitive_arrays>(objects);
+
+        fit_end_bounds();
+
+        // Sphere packs move their spheres themselves.
+        if (options.pack_spheres)
+            linear_bvh_pack_spheres(nodes, *primitives, packs);
+
+        bbox = list.bounding_box();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        return linear_bvh_traverse(nodes, ray_t, rec,
+            [&](uint32_t index, const interval& node_t, real& t_enter) {
+                return node_hit(index, r, node_t, t_enter);
+            },
+            [&](const linear_bvh_node& node, interval leaf_t, hit_record& leaf_rec) {
+                return leaf_hit(node, r, leaf_t, leaf_rec);
+            });
+    }
+
+    void hit_packet(
+        const ray* rays, int count, interval ray_t, hit_record* recs, bool* hits
+    ) const override {
+        // Batches of up to max_ray_packet rays walk the tree together.
+        for (int first = 0; first < count; first += max_ray_packet) {
+            int n = std::min(count - first, max_ray_packet);
+            if (n <= 4)
+                trace_packet<4>(rays + first, n, ray_t, recs + first, hits + first);
+            else if (n <= 8)
+                trace_packet<8>(rays + first, n, ray_t, recs + first, hits + first);
+            else
+                trace_packet<16>(rays + first, n, ray_t, recs + first, hits + first);
+        }
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    size_t node_count() const { return nodes.size(); }
+
+    bvh_stats stats(real time = 0.5) const {
+        // Tree quality for rays at the given time.
+        bvh_stats result;
+        if (!nodes.empty()) {
+            accumulate_stats(result, 0, 0, time);
+            result.finish(bounds_at(0, time));
+        }
+        return result;
+    }
+
+  private:
+    std::vector<linear_bvh_node> nodes;         // Topology and bounds at time 0
+    std::vector<motion_bvh_node_motion> motion;  // Movement of the bounds, one per node
+    std::vector<shared_ptr<hittable>> objects;  // Primitives in leaf order, owns them
+    shared_ptr<primitive_arrays> primitives;
+    std::vector<sphere_pack> packs;
+    aabb bbox;
+
+    void fit_end_bounds() {
+        // Children follow their parents in the node array, so a backward sweep visits every
+        // node after its children.
+        motion.resize(nodes.size());
+        for (size_t i = nodes.size(); i-- > 0; ) {
+            auto& node = nodes[i];
+            aabb start = aabb::empty, end = aabb::empty;
+            if (node.is_leaf()) {
+                for (uint32_t k = node.offset; k < node.offset + node.primitive_count; k++) {
+                    start = aabb(start, objects[k]->bounding_box_at(0));
+                    end = aabb(end, objects[k]->bounding_box_at(1));
+                }
+            } else {
+                start = aabb(nodes[i + 1].bounds(), nodes[node.offset].bounds());
+                end = aabb(bounds_at(i + 1, 1), bounds_at(node.offset, 1));
+            }
+
+            node.set_bounds(start);
+            auto& move = motion[i];
+            for (int axis = 0; axis < 3; axis++) {
+                const auto& span = end.axis_interval(axis);
+                move.min_delta[axis] = round_down_to_float(span.min - node.bounds_min[axis]);
+                move.max_delta[axis] = round_up_to_float(span.max - node.bounds_max[axis]);
+                move.sweep_min[axis] = std::fmin(node.bounds_min[axis], round_down_to_float(span.min));
+                move.sweep_max[axis] = std::fmax(node.bounds_max[axis], round_up_to_float(span.max));
+            }
+        }
+    }
+
+    bool node_hit(uint32_t index, const ray& r, const interval& ray_t, real& t_enter) const {
+        // The slab test of linear_bvh_node::hit on the bounds at the ray's time.
+        const auto& node = nodes[index];
+        const auto& move = motion[index];
+        const point3& origin = r.origin();
+        const vec3& inv_dir = r.inverse_direction();
+        auto time = r.time();
+        auto t_min = ray_t.min;
+        auto t_max = ray_t.max;
+
+        for (int axis = 0; axis < 3; axis++) {
+            real lo = node.bounds_min[axis] + time * move.min_delta[axis];
+            real hi = node.bounds_max[axis] + time * move.max_delta[axis];
+            bool neg = r.dir_is_neg(axis);
+            auto t0 = ((neg ? hi : lo) - origin[axis]) * inv_dir[axis];
+            auto t1 = ((neg ? lo : hi) - origin[axis]) * inv_dir[axis];
+
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+
+            if (t_max < t_min)
+                return false;
+        }
+
+        t_enter = t_min;
+        return true;
+    }
+
+    template <int N>
+    void trace_packet(
+        const ray* rays, int count, interval ray_t, hit_record* recs, bool* hits
+    ) const {
+        // The rays of a packet have times of their own, spread over most of the shutter
+        // interval, so nodes are tested with their bounds over the whole interval. Leaves still
+        // intersect each ray at its own time.
+        linear_bvh_traverse_packet<N>(nodes, rays, count, ray_t, recs, hits,
+            [&](const ray_packet<N>& packet, uint32_t index) {
+                return packet.hit(motion[index].sweep_min, motion[index].sweep_max);
+            },
+            [&](const linear_bvh_node& node, const ray& r, interval leaf_t, hit_record& rec) {
+                return leaf_hit(node, r, leaf_t, rec);
+            });
+    }
+
+    aabb bounds_at(size_t index, real time) const {
+        const auto& node = nodes[index];
+        const auto& move = motion[index];
+        interval axes[3];
+        for (int axis = 0; axis < 3; axis++) {
+            axes[axis] = interval(node.bounds_min[axis] + time * move.min_delta[axis],
+                                  node.bounds_max[axis] + time * move.max_delta[axis]);
+        }
+        return aabb(axes[0], axes[1], axes[2]);
+    }
+
+    bool leaf_hit(const linear_bvh_node& node, const ray& r, interval ray_t, hit_record& rec) const {
+        if (node.packed)
+            return packs[node.offset].hit(r, ray_t, rec);
+
+        bool hit_anything = false;
+        for (uint32_t k = 0; k < node.primitive_count; k++) {
+            if (primitives->hit(node.offset + k, r, ray_t, rec)) {
+                hit_anything = true;
+                ray_t.max = rec.t;
+            }
+        }
+        return hit_anything;
+    }
+
+    void accumulate_stats(bvh_stats& stats, uint32_t index, int depth, real time) const {
+        const auto& node = nodes[index];
+        if (node.is_leaf()) {
+            stats.add_leaf(bounds_at(index, time), node.primitive_count, depth);
+            return;
+        }
+
+        stats.add_interior(bounds_at(index, time), depth);
+        accumulate_stats(stats, index + 1, depth + 1, time);
+        accumulate_stats(stats, node.offset, depth + 1, time);
+    }
+};
+
+#endif
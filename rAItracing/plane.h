@@ -0,0 +1,87 @@
+//
+//  plane.h
+//  rAItracing
+//
+
+#ifndef PLANE_H
+#define PLANE_H
+
+#include "hittable.h"
+#include "material_table.h"
+
+class plane : public hittable {
+  // An infinite plane, such as a ground, through point and facing along normal. Its bounds are
+  // infinite, so it is kept out of acceleration structures (see split_unbounded) and tested
+  // on its own. Texture coordinates repeat every unit along two directions in the plane.
+  public:
+    plane(const point3& point, const vec3& normal, shared_ptr<material> mat)
+      : point(point), normal(unit_vector(normal)), mat(mat), material_id(global_materials().add(mat))
+    {
+        D = dot(this->normal, point);
+
+        // A plane facing along an axis has a normal of exactly +1 or -1 on that axis.
+        for (int axis = 0; axis < 3; axis++) {
+            if (this->normal[(axis + 1) % 3] == 0 && this->normal[(axis + 2) % 3] == 0) {
+                plane_axis = axis;
+                axis_offset = point[axis];
+            }
+        }
+
+        // Any direction not parallel to the normal gives the two in-plane texture directions.
+        auto helper = std::fabs(this->normal.x()) > 0.9 ? vec3(0, 1, 0) : vec3(1, 0, 0);
+        tangent = unit_vector(cross(helper, this->normal));
+        bitangent = cross(this->normal, tangent);
+    }
+
+    aabb bounding_box() const override { return aabb::universe; }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        real t;
+        if (plane_axis >= 0) {
+            if (std::fabs(r.direction()[plane_axis]) < 1e-8)
+                return false;
+            t = (axis_offset - r.origin()[plane_axis]) * r.inverse_direction()[plane_axis];
+        } else {
+            auto denom = dot(normal, r.direction());
+            if (std::fabs(denom) < 1e-8)
+                return false;
+            t = (D - dot(normal, r.origin())) / denom;
+        }
+
+        if (!ray_t.surrounds(t))
+            return false;
+
+        rec.t = t;
+        rec.object = this;
+        rec.material_id = material_id;
+        return true;
+    }
+
+    void finalize_hit(const ray& r, hit_record& rec) const override {
+        // On an axis-aligned plane the hit point is put exactly on the plane, so that solid
+        // textures sampled at the plane's height, like a checker at y = 0, do not flicker
+        // between the cells on either side.
+        rec.p = r.at(rec.t);
+        if (plane_axis >= 0)
+            rec.p[plane_axis] = axis_offset;
+        rec.set_face_normal(r, normal);
+
+        auto offset = rec.p - point;
+        auto a = dot(offset, tangent);
+        auto b = dot(offset, bitangent);
+        rec.u = a - std::floor(a);
+        rec.v = b - std::floor(b);
+    }
+
+  private:
+    point3 point;
+    vec3 normal;
+    vec3 tangent, bitangent;  // Directions of the texture coordinates
+    shared_ptr<material> mat;
+    uint32_t material_id;
+    real D;
+    int plane_axis = -1;  // Axis the plane faces along, or -1 if it is not axis-aligned
+    real axis_offset = 0; // Plane position along plane_axis
+};
+
+#endif
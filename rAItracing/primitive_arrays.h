@@ -0,0 +1,86 @@
+//
+//  primitive_arrays.h
+//  rAItracing
+//
+
+#ifndef PRIMITIVE_ARRAYS_H
+#define PRIMITIVE_ARRAYS_H
+
+#include "hittable.h"
+#include "quad.h"
+#include "sphere.h"
+
+#include <cstdint>
+#include <typeinfo>
+#include <vector>
+
+class primitive_arrays {
+  // A sequence of primitives stored by concrete type: spheres and quads are copied into arrays
+  // of their own and intersected through statically bound calls, so the inner loop of a
+  // traversal makes no vtable call for them. Any other hittable, such as a user-defined shape,
+  // is kept behind its pointer and called virtually.
+  public:
+    enum kind : uint32_t { sphere_kind, quad_kind, other_kind };
+
+    primitive_arrays() {}
+
+    explicit primitive_arrays(const std::vector<shared_ptr<hittable>>& objects) {
+        // Only exact types are copied; a subclass may override hit().
+        size_t sphere_count = 0, quad_count = 0;
+        for (const auto& object : objects) {
+            sphere_count += typeid(*object) == typeid(sphere);
+            quad_count += typeid(*object) == typeid(quad);
+        }
+        spheres.reserve(sphere_count);
+        quads.reserve(quad_count);
+        others.reserve(objects.size() - sphere_count - quad_count);
+
+        refs.reserve(objects.size());
+        for (const auto& object : objects) {
+            if (typeid(*object) == typeid(sphere)) {
+                refs.push_back(make_ref(sphere_kind, spheres.size()));
+                spheres.push_back(static_cast<const sphere&>(*object));
+            } else if (typeid(*object) == typeid(quad)) {
+                refs.push_back(make_ref(quad_kind, quads.size()));
+                quads.push_back(static_cast<const quad&>(*object));
+            } else {
+                refs.push_back(make_ref(other_kind, others.size()));
+                others.push_back(object);
+            }
+        }
+    }
+
+    size_t size() const { return refs.size(); }
+
+    bool hit(size_t k, const ray& r, interval ray_t, hit_record& rec) const {
+        // Intersects the k-th primitive of the sequence.
+        auto ref = refs[k];
+        auto index = ref & index_mask;
+        switch (ref >> kind_shift) {
+            case sphere_kind: return spheres[index].sphere::hit(r, ray_t, rec);
+            case quad_kind:   return quads[index].hit_quad(r, ray_t, rec);
+            default:          return hit_fresh(*others[index], r, ray_t, rec);
+        }
+    }
+
+    const sphere* sphere_at(size_t k) const {
+        // The k-th primitive if it is a plain sphere, otherwise null.
+        auto ref = refs[k];
+        return (ref >> kind_shift) == sphere_kind ? &spheres[ref & index_mask] : nullptr;
+    }
+
+  private:
+    static constexpr uint32_t kind_shift = 30;
+    static constexpr uint32_t index_mask = (1u << kind_shift) - 1;
+
+    std::vector<uint32_t> refs;  // Kind and array index of each primitive, in sequence order
+    std::vector<sphere> spheres;
+    std::vector<quad> quads;
+    std::vector<shared_ptr<hittable>> others;
+
+    static uint32_t make_ref(kind k, size_t index) {
+        return (uint32_t(k) << kind_shift) | uint32_t(index);
+    }
+};
+
+#endif
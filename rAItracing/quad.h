@@ -7,17 +7,27 @@
 #define QUAD_H
 
 #include "hittable.h"
+#include "hittable_list.h"
+#include "material_table.h"
 
 class quad : public hittable {
   public:
     quad(const point3& Q, const vec3& u, const vec3& v, shared_ptr<material> mat)
-      : Q(Q), u(u), v(v), mat(mat)
+      : Q(Q), u(u), v(v), mat(mat), material_id(global_materials().add(mat))
     {
         auto n = cross(u, v);
         normal = unit_vector(n);
         D = dot(normal, Q);
         w = n / dot(n,n);
 
+        // A plane facing along an axis has a normal of exactly +1 or -1 on that axis.
+        for (int axis = 0; axis < 3; axis++) {
+            if (normal[(axis + 1) % 3] == 0 && normal[(axis + 2) % 3] == 0) {
+                plane_axis = axis;
+                axis_offset = D * normal[axis];
+            }
+        }
+
         set_bounding_box();
     }
 
@@ -30,39 +40,28 @@ class quad : public hittable {
 
     aabb bounding_box() const override { return bbox; }
 
-    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-        auto denom = dot(normal, r.direction());
-
-        // No hit if the ray is parallel to the plane.
-        if (std::fabs(denom) < 1e-8)
-            return false;
-
-        // Return false if the hit point parameter t is outside the ray interval.
-        auto t = (D - dot(normal, r.origin())) / denom;
-        if (!ray_t.contains(t))
-            return false;
-
-        // Determine if the hit point lies within the planar shape using its plane coordinates.
-        auto intersection = r.at(t);
-        vec3 planar_hitpt_vector = intersection - Q;
-        auto alpha = dot(w, cross(planar_hitpt_vector, v));
-        auto beta = dot(w, cross(u, planar_hitpt_vector));
+    aabb clipped_bounding_box(const aabb& region) const override {
+        // The parallelogram clipped to the region; shapes drawn inside it are bounded by it too.
+        point3 corners[4] = {Q, Q + u, Q + u + v, Q + v};
+        return clip_to_box(clip_polygon_bounds(corners, 4, region), region);
+    }
 
-        if (!is_interior(alpha, beta, rec))
-            return false;
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        return intersect<false>(r, ray_t, rec);
+    }
 
-        // Ray hits the 2D shape; set the rest of the hit record and return true.
+    bool hit_quad(const ray& r, interval ray_t, hit_record& rec) const {
+        // hit() for an object known to be a plain quad: the interior test is bound statically
+        // instead of going through the vtable.
+        return intersect<true>(r, ray_t, rec);
+    }
 
-        rec.t = t;
-        rec.p = intersection;
-        rec.mat = mat;
+    void finalize_hit(const ray& r, hit_record& rec) const override {
+        rec.p = r.at(rec.t);
         rec.set_face_normal(r, normal);
-
-        return true;
     }
-    
-    
-    virtual bool is_interior(double a, double b, hit_record& rec) const {
+
+    virtual bool is_interior(real a, real b, hit_record& rec) const {
         interval unit_interval = interval(0, 1);
         // Given the hit point in plane coordinates, return false if it is outside the
         // primitive, otherwise set the hit record UV coordinates and return true.
@@ -80,9 +79,77 @@ class quad : public hittable {
     vec3 u, v;
     vec3 w;
     shared_ptr<material> mat;
+    uint32_t material_id;
     aabb bbox;
     vec3 normal;
-    double D;
+    real D;
+    int plane_axis = -1;  // Axis the plane faces along, or -1 if it is not axis-aligned
+    real axis_offset = 0; // Plane position along plane_axis
+
+    template <bool plain_quad>
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const {
+        real t;
+        if (plane_axis >= 0) {
+            // An axis-aligned plane only needs the ray's components along its axis, and the
+            // precomputed reciprocal direction replaces the division.
+            if (std::fabs(r.direction()[plane_axis]) < 1e-8)
+                return false;
+            t = (axis_offset - r.origin()[plane_axis]) * r.inverse_direction()[plane_axis];
+        } else {
+            auto denom = dot(normal, r.direction());
+
+            // No hit if the ray is parallel to the plane.
+            if (std::fabs(denom) < 1e-8)
+                return false;
+
+            t = (D - dot(normal, r.origin())) / denom;
+        }
+
+        // Return false if the hit point parameter t is outside the ray interval.
+        if (!ray_t.contains(t))
+            return false;
+
+        // Determine if the hit point lies within the planar shape using its plane coordinates.
+        auto intersection = r.at(t);
+        vec3 planar_hitpt_vector = intersection - Q;
+        auto alpha = dot(w, cross(planar_hitpt_vector, v));
+        auto beta = dot(w, cross(u, planar_hitpt_vector));
+
+        bool interior = plain_quad ? quad::is_interior(alpha, beta, rec) : is_interior(alpha, beta, rec);
+        if (!interior)
+            return false;
+
+        // Ray hits the 2D shape; the hit point and normal are left to finalize_hit.
+
+        rec.t = t;
+        rec.object = this;
+        rec.material_id = material_id;
+
+        return true;
+    }
 };
 
+inline shared_ptr<hittable_list> box(const point3& a, const point3& b, shared_ptr<material> mat)
+{
+    // Returns the 3D box (six sides) that contains the two opposite vertices a & b.
+
+    auto sides = make_shared<hittable_list>();
+
+    auto min = point3(std::fmin(a.x(),b.x()), std::fmin(a.y(),b.y()), std::fmin(a.z(),b.z()));
+    auto max = point3(std::fmax(a.x(),b.x()), std::fmax(a.y(),b.y()), std::fmax(a.z(),b.z()));
+
+    auto dx = vec3(max.x() - min.x(), 0, 0);
+    auto dy = vec3(0, max.y() - min.y(), 0);
+    auto dz = vec3(0, 0, max.z() - min.z());
+
+    sides->add(make_shared<quad>(point3(min.x(), min.y(), max.z()),  dx,  dy, mat)); // front
+    sides->add(make_shared<quad>(point3(max.x(), min.y(), max.z()), -dz,  dy, mat)); // right
+    sides->add(make_shared<quad>(point3(max.x(), min.y(), min.z()), -dx,  dy, mat)); // back
+    sides->add(make_shared<quad>(point3(min.x(), min.y(), min.z()),  dz,  dy, mat)); // left
+    sides->add(make_shared<quad>(point3(min.x(), max.y(), max.z()),  dx, -dz, mat)); // top
+    sides->add(make_shared<quad>(point3(min.x(), min.y(), min.z()),  dx,  dz, mat)); // bottom
+
+    return sides;
+}
+
 #endif
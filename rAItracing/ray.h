@@ -9,28 +9,53 @@
 #include "vec3.h"
 
 class ray {
+  // Besides its origin, direction and time, a ray carries the values every box and primitive
+  // test would otherwise recompute: the reciprocal of each direction component, the sign of
+  // each component and the direction's squared length. They are set once, at construction.
   public:
     ray() {}
 
-    ray(const point3& origin, const vec3& direction, double time)
-      : orig(origin), dir(direction), tm(time) {}
+    ray(const point3& origin, const vec3& direction, real time)
+      : orig(origin), dir(direction), tm(time)
+    {
+        for (int axis = 0; axis < 3; axis++) {
+            // Division by a zero component gives a signed infinity, which slab tests handle.
+            inv_dir[axis] = 1.0 / dir[axis];
+            sign[axis] = std::signbit(inv_dir[axis]) ? 1 : 0;
+        }
+        dir_length_squared = dir.length_squared();
+    }
 
     ray(const point3& origin, const vec3& direction)
       : ray(origin, direction, 0) {}
-    
+
     const point3& origin() const  { return orig; }
     const vec3& direction() const { return dir; }
-    
-    double time() const { return tm; }
 
-    point3 at(double t) const {
+    real time() const { return tm; }
+
+    // 1 / direction, per component.
+    const vec3& inverse_direction() const { return inv_dir; }
+
+    // 1 if the direction component along axis is negative, 0 otherwise.
+    int dir_is_neg(int axis) const { return sign[axis]; }
+
+    real direction_length_squared() const { return dir_length_squared; }
+
+    // True if the direction has exactly unit length.
+    bool is_normalized() const { return dir_length_squared == 1; }
+
+    point3 at(real t) const {
         return orig + t*dir;
     }
 
   private:
     point3 orig;
     vec3 dir;
-    double tm;
+    real tm;
+    vec3 inv_dir;
+    real dir_length_squared;
+    uint8_t sign[3];
 };
 
 #endif
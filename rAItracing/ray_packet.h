@@ -0,0 +1,130 @@
+//
+//  ray_packet.h
+//  rAItracing
+//
+
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "simd_aabb.h"
+
+const int max_ray_packet = 16;  // Widest packet an accelerator traverses in one pass
+
+template <int N>
+struct ray_packet {
+    // N rays in structure-of-arrays layout, so one box can be tested against every ray of the
+    // packet with a few vector instructions. Slots past the packet's ray count hold an empty
+    // interval and never hit anything.
+
+    static_assert(N % 4 == 0 && N <= max_ray_packet, "ray packets come in multiples of 4 rays");
+
+    alignas(32) float origin[3][N];
+    alignas(32) float inv_dir[3][N];
+    alignas(32) float t_min[N];
+    alignas(32) float t_max[N];
+    int dir_is_neg[3];  // Direction signs of the first ray, used to order child visits
+
+    ray_packet(const ray* rays, int count, const interval& ray_t) {
+        for (int k = 0; k < N; k++) {
+            if (k < count) {
+                const auto& orig = rays[k].origin();
+                const auto& inv = rays[k].inverse_direction();
+                for (int axis = 0; axis < 3; axis++) {
+                    origin[axis][k] = float(orig[axis]);
+                    inv_dir[axis][k] = float(inv[axis]);
+                }
+                t_min[k] = round_down_to_float(ray_t.min);
+                t_max[k] = round_up_to_float(ray_t.max);
+            } else {
+                for (int axis = 0; axis < 3; axis++) {
+                    origin[axis][k] = 0;
+                    inv_dir[axis][k] = 1;
+                }
+                t_min[k] = +std::numeric_limits<float>::infinity();
+                t_max[k] = -std::numeric_limits<float>::infinity();
+            }
+        }
+
+        for (int axis = 0; axis < 3; axis++)
+            dir_is_neg[axis] = count > 0 ? rays[0].dir_is_neg(axis) : 0;
+    }
+
+    void set_t_max(int k, real t) { t_max[k] = round_up_to_float(t); }
+
+    int hit(const float box_min[3], const float box_max[3]) const {
+        // Returns a bit mask of the rays that overlap the box within their current interval.
+        // Rays in a packet may point different ways, so both slab distances are sorted per ray.
+        int mask = 0;
+        int base = 0;
+#if RT_SIMD_AVX
+        for (; base + 8 <= N; base += 8)
+            mask |= hit8(box_min, box_max, base) << base;
+#endif
+#if RT_SIMD_SSE
+        for (; base + 4 <= N; base += 4)
+            mask |= hit4(box_min, box_max, base) << base;
+#endif
+        for (; base < N; base++)
+            mask |= hit1(box_min, box_max, base) << base;
+        return mask;
+    }
+
+  private:
+    int hit1(const float box_min[3], const float box_max[3], int k) const {
+        float t_near = t_min[k];
+        float t_far = t_max[k];
+        for (int axis = 0; axis < 3; axis++) {
+            float t0 = (box_min[axis] - origin[axis][k]) * inv_dir[axis][k];
+            float t1 = (box_max[axis] - origin[axis][k]) * inv_dir[axis][k];
+
+            // Same NaN behavior as the SSE min/max below: a NaN operand yields the second one.
+            float lo = t0 < t1 ? t0 : t1;
+            float hi = t0 > t1 ? t0 : t1;
+            t_near = lo > t_near ? lo : t_near;
+            t_far = hi < t_far ? hi : t_far;
+        }
+        return t_near <= t_far * slab_far_scale ? 1 : 0;
+    }
+
+#if RT_SIMD_SSE
+    int hit4(const float box_min[3], const float box_max[3], int base) const {
+        __m128 t_near = _mm_load_ps(t_min + base);
+        __m128 t_far = _mm_load_ps(t_max + base);
+
+        for (int axis = 0; axis < 3; axis++) {
+            __m128 o = _mm_load_ps(origin[axis] + base);
+            __m128 inv = _mm_load_ps(inv_dir[axis] + base);
+            __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box_min[axis]), o), inv);
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box_max[axis]), o), inv);
+
+            t_near = _mm_max_ps(_mm_min_ps(t0, t1), t_near);
+            t_far = _mm_min_ps(_mm_max_ps(t0, t1), t_far);
+        }
+
+        t_far = _mm_mul_ps(t_far, _mm_set1_ps(slab_far_scale));
+        return _mm_movemask_ps(_mm_cmple_ps(t_near, t_far));
+    }
+#endif
+
+#if RT_SIMD_AVX
+    int hit8(const float box_min[3], const float box_max[3], int base) const {
+        __m256 t_near = _mm256_load_ps(t_min + base);
+        __m256 t_far = _mm256_load_ps(t_max + base);
+
+        for (int axis = 0; axis < 3; axis++) {
+            __m256 o = _mm256_load_ps(origin[axis] + base);
+            __m256 inv = _mm256_load_ps(inv_dir[axis] + base);
+            __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(box_min[axis]), o), inv);
+            __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(box_max[axis]), o), inv);
+
+            t_near = _mm256_max_ps(_mm256_min_ps(t0, t1), t_near);
+            t_far = _mm256_min_ps(_mm256_max_ps(t0, t1), t_far);
+        }
+
+        t_far = _mm256_mul_ps(t_far, _mm256_set1_ps(slab_far_scale));
+        return _mm256_movemask_ps(_mm256_cmp_ps(t_near, t_far, _CMP_LE_OQ));
+    }
+#endif
+};
+
+#endif
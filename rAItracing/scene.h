@@ -0,0 +1,19 @@
+//
+//  scene.h
+//  rAItracing
+//
+
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "camera.h"
+#include "hittable_list.h"
+
+class scene {
+  // A world together with the camera set up to view it.
+  public:
+    hittable_list world;
+    camera cam;
+};
+
+#endif
@@ -0,0 +1,189 @@
+//
+//  simd_aabb.h
+//  rAItracing
+//
+
+#ifndef SIMD_AABB_H
+#define SIMD_AABB_H
+
+// Wide ray-box slab tests: one ray against 4 or 8 boxes stored side by side. SSE and AVX builds
+// test all boxes with a handful of vector instructions; other targets use the scalar loop, which
+// compilers can still auto-vectorize.
+
+#include "aabb.h"
+
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+    #include <immintrin.h>
+    #define RT_SIMD_SSE 1
+#endif
+
+#if defined(__AVX__)
+    #define RT_SIMD_AVX 1
+#endif
+
+struct slab_ray {
+    // The ray data a slab test needs, converted to float and computed once per ray rather than
+    // once per box.
+
+    float origin[3];
+    float inv_dir[3];
+    int   dir_is_neg[3];  // Selects which slab plane of each axis the ray enters through
+
+    explicit slab_ray(const ray& r) {
+        for (int axis = 0; axis < 3; axis++) {
+            origin[axis] = float(r.origin()[axis]);
+            inv_dir[axis] = float(r.inverse_direction()[axis]);
+            dir_is_neg[axis] = r.dir_is_neg(axis);
+        }
+    }
+};
+
+// Widens the far distance to absorb float rounding in the slab test, so a box the ray touches is
+// never culled (see "Robust BVH Ray Traversal", Ize 2013).
+const float slab_far_scale = 1.0f + 2 * (3 * 0.5f * std::numeric_limits<float>::epsilon());
+
+template <int N>
+struct wide_aabb {
+    // N boxes in structure-of-arrays layout: bounds[0] holds the minimums and bounds[1] the
+    // maximums, each as one row of N floats per axis. Unused slots hold empty boxes, which no
+    // ray hits.
+
+    alignas(32) float bounds[2][3][N];
+
+    wide_aabb() {
+        for (int i = 0; i < N; i++)
+            set_empty(i);
+    }
+
+    void set(int i, const aabb& box) {
+        // Rounded outward, so the float box always contains the full precision one.
+        for (int axis = 0; axis < 3; axis++) {
+            bounds[0][axis][i] = round_down_to_float(box.axis_interval(axis).min);
+            bounds[1][axis][i] = round_up_to_float(box.axis_interval(axis).max);
+        }
+    }
+
+    void set_empty(int i) {
+        for (int axis = 0; axis < 3; axis++) {
+            bounds[0][axis][i] = +std::numeric_limits<float>::infinity();
+            bounds[1][axis][i] = -std::numeric_limits<float>::infinity();
+        }
+    }
+
+    aabb get(int i) const {
+        return aabb(interval(bounds[0][0][i], bounds[1][0][i]),
+                    interval(bounds[0][1][i], bounds[1][1][i]),
+                    interval(bounds[0][2][i], bounds[1][2][i]));
+    }
+
+    int hit(const slab_ray& r, float t_min, float t_max, float t_enter[N]) const {
+        // Returns a bit mask of the boxes the ray overlaps within [t_min,t_max], and writes the
+        // entry distance of every box to t_enter (meaningful only for boxes in the mask).
+        return hit_scalar(r, t_min, t_max, t_enter);
+    }
+
+    int hit_scalar(const slab_ray& r, float t_min, float t_max, float t_enter[N]) const {
+        int mask = 0;
+        for (int i = 0; i < N; i++) {
+            float t_near = t_min;
+            float t_far = t_max;
+            for (int axis = 0; axis < 3; axis++) {
+                float t0 = (bounds[r.dir_is_neg[axis]][axis][i] - r.origin[axis]) * r.inv_dir[axis];
+                float t1 = (bounds[1 - r.dir_is_neg[axis]][axis][i] - r.origin[axis]) * r.inv_dir[axis];
+
+                // Comparisons ordered so a NaN (origin on a slab plane, zero direction) is ignored.
+                t_near = t0 > t_near ? t0 : t_near;
+                t_far = t1 < t_far ? t1 : t_far;
+            }
+            t_enter[i] = t_near;
+            if (t_near <= t_far * slab_far_scale)
+                mask |= 1 << i;
+        }
+        return mask;
+    }
+};
+
+using aabb4 = wide_aabb<4>;
+using aabb8 = wide_aabb<8>;
+
+#if RT_SIMD_SSE
+
+template <>
+inline int wide_aabb<4>::hit(const slab_ray& r, float t_min, float t_max, float t_enter[4]) const {
+    __m128 t_near = _mm_set1_ps(t_min);
+    __m128 t_far = _mm_set1_ps(t_max);
+
+    for (int axis = 0; axis < 3; axis++) {
+        __m128 origin = _mm_set1_ps(r.origin[axis]);
+        __m128 inv_dir = _mm_set1_ps(r.inv_dir[axis]);
+        __m128 near_plane = _mm_load_ps(bounds[r.dir_is_neg[axis]][axis]);
+        __m128 far_plane = _mm_load_ps(bounds[1 - r.dir_is_neg[axis]][axis]);
+
+        // _mm_max_ps/_mm_min_ps return their second operand when the first one is NaN.
+        t_near = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(near_plane, origin), inv_dir), t_near);
+        t_far = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(far_plane, origin), inv_dir), t_far);
+    }
+
+    _mm_storeu_ps(t_enter, t_near);
+    t_far = _mm_mul_ps(t_far, _mm_set1_ps(slab_far_scale));
+    return _mm_movemask_ps(_mm_cmple_ps(t_near, t_far));
+}
+
+#endif
+
+#if RT_SIMD_AVX
+
+template <>
+inline int wide_aabb<8>::hit(const slab_ray& r, float t_min, float t_max, float t_enter[8]) const {
+    __m256 t_near = _mm256_set1_ps(t_min);
+    __m256 t_far = _mm256_set1_ps(t_max);
+
+    for (int axis = 0; axis < 3; axis++) {
+        __m256 origin = _mm256_set1_ps(r.origin[axis]);
+        __m256 inv_dir = _mm256_set1_ps(r.inv_dir[axis]);
+        __m256 near_plane = _mm256_load_ps(bounds[r.dir_is_neg[axis]][axis]);
+        __m256 far_plane = _mm256_load_ps(bounds[1 - r.dir_is_neg[axis]][axis]);
+
+        t_near = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(near_plane, origin), inv_dir), t_near);
+        t_far = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(far_plane, origin), inv_dir), t_far);
+    }
+
+    _mm256_storeu_ps(t_enter, t_near);
+    t_far = _mm256_mul_ps(t_far, _mm256_set1_ps(slab_far_scale));
+    return _mm256_movemask_ps(_mm256_cmp_ps(t_near, t_far, _CMP_LE_OQ));
+}
+
+#elif RT_SIMD_SSE
+
+template <>
+inline int wide_aabb<8>::hit(const slab_ray& r, float t_min, float t_max, float t_enter[8]) const {
+    // Without AVX, test the two halves of the 8 boxes with 4-wide SSE.
+    __m128 mask_lo, mask_hi;
+
+    for (int half = 0; half < 2; half++) {
+        __m128 t_near = _mm_set1_ps(t_min);
+        __m128 t_far = _mm_set1_ps(t_max);
+
+        for (int axis = 0; axis < 3; axis++) {
+            __m128 origin = _mm_set1_ps(r.origin[axis]);
+            __m128 inv_dir = _mm_set1_ps(r.inv_dir[axis]);
+            __m128 near_plane = _mm_load_ps(bounds[r.dir_is_neg[axis]][axis] + 4*half);
+            __m128 far_plane = _mm_load_ps(bounds[1 - r.dir_is_neg[axis]][axis] + 4*half);
+
+            t_near = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(near_plane, origin), inv_dir), t_near);
+            t_far = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(far_plane, origin), inv_dir), t_far);
+        }
+
+        _mm_storeu_ps(t_enter + 4*half, t_near);
+        t_far = _mm_mul_ps(t_far, _mm_set1_ps(slab_far_scale));
+        (half == 0 ? mask_lo : mask_hi) = _mm_cmple_ps(t_near, t_far);
+    }
+
+    return _mm_movemask_ps(mask_lo) | (_mm_movemask_ps(mask_hi) << 4);
+}
+
+#endif
+
+#endif
@@ -9,20 +9,23 @@
 #define SPHERE_H
 
 #include "hittable.h"
+#include "material_table.h"
 
 class sphere : public hittable {
   public:
     // Stationary Sphere
-    sphere(const point3& static_center, double radius, shared_ptr<material> mat)
-        : center(static_center, vec3(0,0,0)), radius(std::fmax(0,radius)), mat(mat)
+    sphere(const point3& static_center, real radius, shared_ptr<material> mat)
+        : center(static_center, vec3(0,0,0)), radius(std::fmax(0,radius)), mat(mat),
+          material_id(global_materials().add(mat))
       {
           auto rvec = vec3(radius, radius, radius);
           bbox = aabb(static_center - rvec, static_center + rvec);
       }
 
     // Moving Sphere
-    sphere(const point3& center1, const point3& center2, double radius, shared_ptr<material> mat)
-        : center(center1, center2 - center1), radius(std::fmax(0,radius)), mat(mat)
+    sphere(const point3& center1, const point3& center2, real radius, shared_ptr<material> mat)
+        : center(center1, center2 - center1), radius(std::fmax(0,radius)), mat(mat),
+          material_id(global_materials().add(mat))
       {
           auto rvec = vec3(radius, radius, radius);
           aabb box1(center.at(0) - rvec, center.at(0) + rvec);
@@ -34,7 +37,7 @@ class sphere : public hittable {
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
         point3 current_center = center.at(r.time());
         vec3 oc = current_center - r.origin();
-        auto a = r.direction().length_squared();
+        auto a = r.direction_length_squared();
         auto h = dot(r.direction(), oc);
         auto c = oc.length_squared() - radius*radius;
 
@@ -44,33 +47,49 @@ class sphere : public hittable {
 
         auto sqrtd = std::sqrt(discriminant);
 
-        // Find the nearest root that lies in the acceptable range.
-        auto root = (h - sqrtd) / a;
+        // Find the nearest root that lies in the acceptable range. A unit direction has a == 1.
+        bool unit = r.is_normalized();
+        auto root = unit ? h - sqrtd : (h - sqrtd) / a;
         if (!ray_t.surrounds(root)) {
-            root = (h + sqrtd) / a;
+            root = unit ? h + sqrtd : (h + sqrtd) / a;
             if (!ray_t.surrounds(root))
                 return false;
         }
 
         rec.t = root;
+        rec.object = this;
+        rec.material_id = material_id;
+
+        return true;
+    }
+
+    void finalize_hit(const ray& r, hit_record& rec) const override {
+        point3 current_center = center.at(r.time());
         rec.p = r.at(rec.t);
         vec3 outward_normal = (rec.p - current_center) / radius;
         rec.set_face_normal(r, outward_normal);
         get_sphere_uv(outward_normal, rec.u, rec.v);
-        rec.mat = mat;
-
-        return true;
     }
     
     aabb bounding_box() const override { return bbox; }
 
+    aabb bounding_box_at(real time) const override {
+        auto rvec = vec3(radius, radius, radius);
+        return aabb(center.at(time) - rvec, center.at(time) + rvec);
+    }
+
+    // The center's path over the shutter interval and the radius, for packing spheres together.
+    const ray& center_path() const { return center; }
+    real sphere_radius() const { return radius; }
+
   private:
     ray center;
-    double radius;
+    real radius;
     shared_ptr<material> mat;
+    uint32_t material_id;
     aabb bbox;
     
-    static void get_sphere_uv(const point3& p, double& u, double& v) {
+    static void get_sphere_uv(const point3& p, real& u, real& v) {
         // p: a given point on the sphere of radius one, centered at the origin.
         // u: returned value [0,1] of angle around the Y axis from X=-1.
         // v: returned value [0,1] of angle from Y=-1 to Y=+1.
@@ -0,0 +1,195 @@
+//
+//  sphere_pack.h
+//  rAItracing
+//
+
+#ifndef SPHERE_PACK_H
+#define SPHERE_PACK_H
+
+#include "hittable.h"
+#include "simd_aabb.h"
+#include "sphere.h"
+
+#include <cstdint>
+#include <type_traits>
+
+const int sphere_pack_width = 4;  // Spheres per pack, the default BVH leaf size
+
+#if RT_SIMD_SSE
+
+// The handful of vector operations the sphere pack kernel needs, for either precision: four
+// floats or two doubles per SSE register.
+
+struct sse_float {
+    using vec = __m128;
+    static constexpr int width = 4;
+    static vec set1(float x) { return _mm_set1_ps(x); }
+    static vec load(const float* p) { return _mm_load_ps(p); }
+    static void store(float* p, vec x) { _mm_store_ps(p, x); }
+    static vec add(vec a, vec b) { return _mm_add_ps(a, b); }
+    static vec sub(vec a, vec b) { return _mm_sub_ps(a, b); }
+    static vec mul(vec a, vec b) { return _mm_mul_ps(a, b); }
+    static vec div(vec a, vec b) { return _mm_div_ps(a, b); }
+    static vec sqrt(vec a) { return _mm_sqrt_ps(a); }
+    static vec max(vec a, vec b) { return _mm_max_ps(a, b); }
+    static vec less(vec a, vec b) { return _mm_cmplt_ps(a, b); }
+    static vec not_less(vec a, vec b) { return _mm_cmpnlt_ps(a, b); }
+    static vec both(vec a, vec b) { return _mm_and_ps(a, b); }
+    static vec select(vec mask, vec a, vec b) {
+        return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+    }
+};
+
+struct sse_double {
+    using vec = __m128d;
+    static constexpr int width = 2;
+    static vec set1(double x) { return _mm_set1_pd(x); }
+    static vec load(const double* p) { return _mm_load_pd(p); }
+    static void store(double* p, vec x) { _mm_store_pd(p, x); }
+    static vec add(vec a, vec b) { return _mm_add_pd(a, b); }
+    static vec sub(vec a, vec b) { return _mm_sub_pd(a, b); }
+    static vec mul(vec a, vec b) { return _mm_mul_pd(a, b); }
+    static vec div(vec a, vec b) { return _mm_div_pd(a, b); }
+    static vec sqrt(vec a) { return _mm_sqrt_pd(a); }
+    static vec max(vec a, vec b) { return _mm_max_pd(a, b); }
+    static vec less(vec a, vec b) { return _mm_cmplt_pd(a, b); }
+    static vec not_less(vec a, vec b) { return _mm_cmpnlt_pd(a, b); }
+    static vec both(vec a, vec b) { return _mm_and_pd(a, b); }
+    static vec select(vec mask, vec a, vec b) {
+        return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+    }
+};
+
+#endif
+
+class sphere_pack {
+  // The spheres of one BVH leaf in structure-of-arrays layout. One SIMD kernel finds the roots
+  // of the ray against the whole pack (SSE on x86, a scalar loop elsewhere); only the nearest
+  // candidate is then intersected by its own sphere, so the hit record comes out exactly as
+  // sphere::hit writes it. Packs only hold plain spheres, so that call is bound statically.
+  public:
+    uint32_t first_primitive = 0;  // Index of the pack's first sphere in the BVH's leaf order
+
+    sphere_pack() {
+        for (int i = 0; i < sphere_pack_width; i++) {
+            for (int axis = 0; axis < 3; axis++) {
+                center[axis][i] = 0;
+                motion[axis][i] = 0;
+            }
+            // An infinitely negative squared radius makes c infinite, so padding never hits.
+            radius_squared[i] = -infinity;
+            spheres[i] = nullptr;
+        }
+    }
+
+    int size() const { return count; }
+
+    void add(const sphere* s) {
+        const auto& path = s->center_path();
+        for (int axis = 0; axis < 3; axis++) {
+            center[axis][count] = path.origin()[axis];
+            motion[axis][count] = path.direction()[axis];
+        }
+        radius_squared[count] = s->sphere_radius() * s->sphere_radius();
+        spheres[count] = s;
+        count++;
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const {
+        alignas(32) real t[sphere_pack_width];
+#if RT_SIMD_SSE
+        using lanes = std::conditional_t<std::is_same_v<real, float>, sse_float, sse_double>;
+        roots<lanes>(r, ray_t, t);
+#else
+        roots_scalar(r, ray_t, t);
+#endif
+
+        // Let the nearest candidates fill in the record, in case rounding made one a false hit.
+        while (true) {
+            int nearest = -1;
+            real nearest_t = infinity;
+            for (int i = 0; i < count; i++) {
+                if (t[i] < nearest_t) {
+                    nearest = i;
+                    nearest_t = t[i];
+                }
+            }
+            if (nearest < 0)
+                return false;
+            if (spheres[nearest]->sphere::hit(r, ray_t, rec))
+                return true;
+            t[nearest] = infinity;
+        }
+    }
+
+  private:
+#if RT_SIMD_SSE
+    template <typename V>
+    void roots(const ray& r, const interval& ray_t, real t[sphere_pack_width]) const {
+        // Same arithmetic as roots_scalar, V::width spheres at a time.
+        using vec = typename V::vec;
+        const auto& origin = r.origin();
+        const auto& dir = r.direction();
+
+        vec dx = V::set1(dir[0]), dy = V::set1(dir[1]), dz = V::set1(dir[2]);
+        vec time = V::set1(r.time());
+        vec a = V::set1(r.direction_length_squared());
+        vec t_min = V::set1(ray_t.min), t_max = V::set1(ray_t.max);
+        vec zero = V::set1(0), none = V::set1(infinity);
+
+        for (int base = 0; base < sphere_pack_width; base += V::width) {
+            vec ocx = V::sub(V::add(V::load(center[0] + base), V::mul(time, V::load(motion[0] + base))), V::set1(origin[0]));
+            vec ocy = V::sub(V::add(V::load(center[1] + base), V::mul(time, V::load(motion[1] + base))), V::set1(origin[1]));
+            vec ocz = V::sub(V::add(V::load(center[2] + base), V::mul(time, V::load(motion[2] + base))), V::set1(origin[2]));
+
+            vec h = V::add(V::add(V::mul(dx, ocx), V::mul(dy, ocy)), V::mul(dz, ocz));
+            vec oc2 = V::add(V::add(V::mul(ocx, ocx), V::mul(ocy, ocy)), V::mul(ocz, ocz));
+            vec c = V::sub(oc2, V::load(radius_squared + base));
+            vec discriminant = V::sub(V::mul(h, h), V::mul(a, c));
+            vec sqrtd = V::sqrt(V::max(discriminant, zero));
+
+            vec near_root = V::div(V::sub(h, sqrtd), a);
+            vec far_root = V::div(V::add(h, sqrtd), a);
+            vec near_ok = V::both(V::less(t_min, near_root), V::less(near_root, t_max));
+            vec far_ok = V::both(V::less(t_min, far_root), V::less(far_root, t_max));
+
+            vec root = V::select(near_ok, near_root, V::select(far_ok, far_root, none));
+            V::store(t + base, V::select(V::not_less(discriminant, zero), root, none));
+        }
+    }
+#endif
+
+    void roots_scalar(const ray& r, const interval& ray_t, real t[sphere_pack_width]) const {
+        // The root finding of sphere::hit for every slot: the entering root if it lies in
+        // ray_t, else the exiting one, else infinity.
+        const auto& origin = r.origin();
+        const auto& dir = r.direction();
+        auto time = r.time();
+        auto a = r.direction_length_squared();
+
+        for (int i = 0; i < sphere_pack_width; i++) {
+            real ocx = center[0][i] + time*motion[0][i] - origin[0];
+            real ocy = center[1][i] + time*motion[1][i] - origin[1];
+            real ocz = center[2][i] + time*motion[2][i] - origin[2];
+
+            real h = dir[0]*ocx + dir[1]*ocy + dir[2]*ocz;
+            real c = (ocx*ocx + ocy*ocy + ocz*ocz) - radius_squared[i];
+            real discriminant = h*h - a*c;
+            real sqrtd = std::sqrt(discriminant > 0 ? discriminant : 0);
+
+            real near_root = (h - sqrtd) / a;
+            real far_root = (h + sqrtd) / a;
+            bool near_ok = ray_t.min < near_root && near_root < ray_t.max;
+            bool far_ok = ray_t.min < far_root && far_root < ray_t.max;
+            t[i] = discriminant < 0 ? infinity : near_ok ? near_root : far_ok ? far_root : infinity;
+        }
+    }
+
+    alignas(32) real center[3][sphere_pack_width];  // Centers at time 0
+    alignas(32) real motion[3][sphere_pack_width];  // Center displacement from time 0 to 1
+    alignas(32) real radius_squared[sphere_pack_width];
+    const sphere* spheres[sphere_pack_width];
+    int count = 0;
+};
+
+#endif
@@ -13,16 +13,16 @@ class texture {
   public:
     virtual ~texture() = default;
 
-    virtual color value(double u, double v, const point3& p) const = 0;
+    virtual color value(real u, real v, const point3& p) const = 0;
 };
 
 class solid_color : public texture {
   public:
     solid_color(const color& albedo) : albedo(albedo) {}
 
-    solid_color(double red, double green, double blue) : solid_color(color(red,green,blue)) {}
+    solid_color(real red, real green, real blue) : solid_color(color(red,green,blue)) {}
 
-    color value(double u, double v, const point3& p) const override {
+    color value(real u, real v, const point3& p) const override {
         return albedo;
     }
 
@@ -32,13 +32,13 @@ class solid_color : public texture {
 
 class checker_texture : public texture {
   public:
-    checker_texture(double scale, shared_ptr<texture> even, shared_ptr<texture> odd)
+    checker_texture(real scale, shared_ptr<texture> even, shared_ptr<texture> odd)
       : inv_scale(1.0 / scale), even(even), odd(odd) {}
 
-    checker_texture(double scale, const color& c1, const color& c2)
+    checker_texture(real scale, const color& c1, const color& c2)
       : checker_texture(scale, make_shared<solid_color>(c1), make_shared<solid_color>(c2)) {}
 
-    color value(double u, double v, const point3& p) const override {
+    color value(real u, real v, const point3& p) const override {
         auto xInteger = int(std::floor(inv_scale * p.x()));
         auto yInteger = int(std::floor(inv_scale * p.y()));
         auto zInteger = int(std::floor(inv_scale * p.z()));
@@ -49,7 +49,7 @@ class checker_texture : public texture {
     }
 
   private:
-    double inv_scale;
+    real inv_scale;
     shared_ptr<texture> even;
     shared_ptr<texture> odd;
 };
@@ -58,7 +58,7 @@ class image_texture : public texture {
   public:
     image_texture(const char* filename) : image(filename) {}
 
-    color value(double u, double v, const point3& p) const override {
+    color value(real u, real v, const point3& p) const override {
         // If we have no texture data, then return solid cyan as a debugging aid.
         if (image.height() <= 0) return color(0,1,1);
 
@@ -80,15 +80,15 @@ class image_texture : public texture {
 
 class noise_texture : public texture {
   public:
-    noise_texture(double scale) : scale(scale) {}
+    noise_texture(real scale) : scale(scale) {}
 
-    color value(double u, double v, const point3& p) const override {
+    color value(real u, real v, const point3& p) const override {
         return color(.5, .5, .5) * (1 + std::sin(scale * p.z() + 10 * noise.turb(p, 7)));
     }
 
   private:
     perlin noise;
-    double scale;
+    real scale;
 };
 
 #endif
@@ -0,0 +1,171 @@
+//
+//  thread_pool.h
+//  rAItracing
+//
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class thread_pool {
+  public:
+    explicit thread_pool(int thread_count = 0) {
+        if (thread_count <= 0)
+            thread_count = hardware_threads();
+
+        for (int i = 0; i < thread_count; i++)
+            queues.push_back(std::make_unique<work_queue>());
+
+        for (int i = 0; i < thread_count; i++)
+            workers.emplace_back([this, i] { worker_loop(i); });
+    }
+
+    ~thread_pool() {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    int size() const { return int(workers.size()); }
+
+    static int hardware_threads() {
+        auto count = std::thread::hardware_concurrency();
+        return count > 0 ? int(count) : 1;
+    }
+
+    template <typename Body>
+    void parallel_for(size_t count, const Body& body) {
+        // Runs body(0) .. body(count-1) on the pool and returns once all of them finished. The
+        // calling thread executes queued tasks while it waits, so this may be nested inside a
+        // task without deadlocking the pool.
+
+        std::atomic<size_t> remaining(count);
+
+        for (size_t index = 0; index < count; index++) {
+            push([&body, &remaining, index] {
+                body(index);
+                remaining.fetch_sub(1, std::memory_order_release);
+            });
+        }
+
+        while (remaining.load(std::memory_order_acquire) > 0) {
+            if (!run_one(current_worker()))
+                std::this_thread::yield();
+        }
+    }
+
+  private:
+    struct work_queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<work_queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> next_queue{0};
+    std::atomic<int> queued{0};
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    int current_worker() const {
+        // Index of the calling thread within this pool, or -1 for outside threads.
+        return worker_pool() == this ? worker_index() : -1;
+    }
+
+    static const thread_pool*& worker_pool() {
+        thread_local const thread_pool* pool = nullptr;
+        return pool;
+    }
+
+    static int& worker_index() {
+        thread_local int index = -1;
+        return index;
+    }
+
+    void push(std::function<void()> task) {
+        // Workers push onto their own queue, outside threads spread tasks round-robin.
+        auto self = current_worker();
+        auto index = self >= 0 ? size_t(self) : next_queue.fetch_add(1) % queues.size();
+
+        {
+            std::lock_guard<std::mutex> lock(queues[index]->mutex);
+            queues[index]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            queued++;
+        }
+        wake.notify_one();
+    }
+
+    bool pop(int self, std::function<void()>& task) {
+        // Take the newest task from our own queue, otherwise steal the oldest from another one.
+        if (self >= 0) {
+            auto& own = *queues[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+
+        auto count = queues.size();
+        auto start = self >= 0 ? size_t(self) + 1 : 0;
+        for (size_t k = 0; k < count; k++) {
+            auto& victim = *queues[(start + k) % count];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool run_one(int self) {
+        std::function<void()> task;
+        if (!pop(self, task))
+            return false;
+
+        queued--;
+        task();
+        return true;
+    }
+
+    void worker_loop(int index) {
+        worker_pool() = this;
+        worker_index() = index;
+
+        while (true) {
+            if (run_one(index))
+                continue;
+
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            wake.wait(lock, [this] { return stopping || queued.load() > 0; });
+            if (stopping && queued.load() == 0)
+                return;
+        }
+    }
+};
+
+#endif
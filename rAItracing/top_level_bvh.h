@@ -0,0 +1,134 @@
+//
+//  top_level_bvh.h
+//  rAItracing
+//
+
+#ifndef TOP_LEVEL_BVH_H
+#define TOP_LEVEL_BVH_H
+
+#include "bvh_build.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+
+#include <chrono>
+#include <vector>
+
+const double top_level_rebuild_ratio = 1.5;  // SAH cost growth past which a refit is rebuilt
+
+struct top_level_update {
+    bool   rebuilt = false;  // Whether the tree was rebuilt rather than refit
+    double milliseconds = 0;
+    double sah_cost = 0;     // Cost of the tree after the update
+};
+
+class top_level_bvh : public hittable {
+  // The upper level of a two-level acceleration structure: a BVH over whole objects, typically
+  // instances of bottom-level BVHs and meshes. When objects move between frames, update() refits
+  // the node bounds in one pass over the tree and leaves every bottom-level tree as it is. A
+  // refit keeps the old topology, so once moves have degraded its SAH cost by more than
+  // top_level_rebuild_ratio the tree is rebuilt instead, which is still cheap for a few thousand
+  // objects. Updates must not run while a render is tracing the tree.
+  public:
+    top_level_bvh(const hittable_list& list, const bvh_build_options& options = {})
+      : source(list.objects), options(options)
+    {
+        rebuild();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        return linear_bvh_traverse(nodes, r, ray_t, rec,
+            [&](const linear_bvh_node& node, interval leaf_t, hit_record& leaf_rec) {
+                bool hit_anything = false;
+                for (uint32_t k = node.offset; k < node.offset + node.primitive_count; k++) {
+                    if (hit_fresh(*objects[k], r, leaf_t, leaf_rec)) {
+                        hit_anything = true;
+                        leaf_t.max = leaf_rec.t;
+                    }
+                }
+                return hit_anything;
+            });
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    top_level_update update() {
+        // Brings the tree up to date with the objects' current bounds.
+        using clock = std::chrono::steady_clock;
+        auto start = clock::now();
+
+        top_level_update result;
+        refit();
+        result.sah_cost = stats().sah_cost;
+        if (result.sah_cost > top_level_rebuild_ratio * built_cost) {
+            rebuild();
+            result.rebuilt = true;
+            result.sah_cost = built_cost;
+        }
+
+        result.milliseconds = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+        return result;
+    }
+
+    void rebuild() {
+        auto tree = linear_bvh_builder(options).build(source.size(), [&](size_t i) {
+            return source[i]->bounding_box();
+        });
+        nodes = std::move(tree.nodes);
+
+        objects.clear();
+        objects.reserve(tree.order.size());
+        for (auto index : tree.order)
+            objects.push_back(source[index].get());
+
+        bbox = nodes.empty() ? aabb() : nodes[0].bounds();
+        built_cost = stats().sah_cost;
+    }
+
+    void refit() {
+        // Children follow their parents in the node array, so a backward sweep visits every
+        // node after its children.
+        for (size_t i = nodes.size(); i-- > 0; ) {
+            auto& node = nodes[i];
+            aabb box = aabb::empty;
+            if (node.is_leaf()) {
+                for (uint32_t k = node.offset; k < node.offset + node.primitive_count; k++)
+                    box = aabb(box, objects[k]->bounding_box());
+            } else {
+                box = aabb(nodes[i + 1].bounds(), nodes[node.offset].bounds());
+            }
+            node.set_bounds(box);
+        }
+        bbox = nodes.empty() ? aabb() : nodes[0].bounds();
+    }
+
+    bvh_stats stats() const {
+        bvh_stats result;
+        if (!nodes.empty()) {
+            accumulate_stats(result, 0, 0);
+            result.finish(nodes[0].bounds());
+        }
+        return result;
+    }
+
+  private:
+    std::vector<shared_ptr<hittable>> source;  // The objects as given, owns them
+    std::vector<const hittable*> objects;       // The same objects in leaf order
+    std::vector<linear_bvh_node> nodes;
+    bvh_build_options options;
+    double built_cost = 0;                      // SAH cost right after the last rebuild
+    aabb bbox;
+
+    void accumulate_stats(bvh_stats& stats, uint32_t index, int depth) const {
+        const auto& node = nodes[index];
+        if (node.is_leaf()) {
+            stats.add_leaf(node.bounds(), node.primitive_count, depth);
+            return;
+        }
+
+        stats.add_interior(node.bounds(), depth);
+        accumulate_stats(stats, index + 1, depth + 1);
+        accumulate_stats(stats, node.offset, depth + 1);
+    }
+};
+
+#endif
@@ -0,0 +1,131 @@
+//
+//  transform.h
+//  rAItracing
+//
+
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "aabb.h"
+
+class transform {
+  // An affine transform: a 3x3 linear part followed by a translation, stored as the top three
+  // rows of a 4x4 matrix. Transforms compose like matrices, so (a * b) applies b first.
+  public:
+    transform() {
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 4; j++)
+                m[i][j] = (i == j) ? 1 : 0;
+    }
+
+    static transform translation(const vec3& offset) {
+        transform t;
+        for (int i = 0; i < 3; i++)
+            t.m[i][3] = offset[i];
+        return t;
+    }
+
+    static transform scaling(const vec3& factors) {
+        transform t;
+        for (int i = 0; i < 3; i++)
+            t.m[i][i] = factors[i];
+        return t;
+    }
+
+    static transform scaling(real factor) { return scaling(vec3(factor, factor, factor)); }
+
+    static transform rotation(const vec3& axis, real degrees) {
+        // Counterclockwise rotation about axis, looking down the axis towards the origin.
+        auto a = unit_vector(axis);
+        auto theta = degrees_to_radians(degrees);
+        auto c = std::cos(theta), s = std::sin(theta), k = 1 - c;
+
+        transform t;
+        t.m[0][0] = a.x()*a.x()*k + c;        t.m[0][1] = a.x()*a.y()*k - a.z()*s;  t.m[0][2] = a.x()*a.z()*k + a.y()*s;
+        t.m[1][0] = a.y()*a.x()*k + a.z()*s;  t.m[1][1] = a.y()*a.y()*k + c;        t.m[1][2] = a.y()*a.z()*k - a.x()*s;
+        t.m[2][0] = a.z()*a.x()*k - a.y()*s;  t.m[2][1] = a.z()*a.y()*k + a.x()*s;  t.m[2][2] = a.z()*a.z()*k + c;
+        return t;
+    }
+
+    friend transform operator*(const transform& a, const transform& b) {
+        transform t;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 4; j++) {
+                t.m[i][j] = a.m[i][0]*b.m[0][j] + a.m[i][1]*b.m[1][j] + a.m[i][2]*b.m[2][j];
+                if (j == 3)
+                    t.m[i][j] += a.m[i][3];
+            }
+        }
+        return t;
+    }
+
+    transform inverse() const {
+        // The linear part is inverted through its cofactors; the translation is undone after it.
+        // A singular transform, such as a zero scale, has no inverse and yields infinities.
+        real c[3][3];
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                int i1 = (i + 1) % 3, i2 = (i + 2) % 3, j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+                c[j][i] = m[i1][j1]*m[i2][j2] - m[i1][j2]*m[i2][j1];
+            }
+        }
+        auto det = m[0][0]*c[0][0] + m[0][1]*c[1][0] + m[0][2]*c[2][0];
+        auto inv_det = 1 / det;
+
+        transform t;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++)
+                t.m[i][j] = c[i][j] * inv_det;
+            t.m[i][3] = -(t.m[i][0]*m[0][3] + t.m[i][1]*m[1][3] + t.m[i][2]*m[2][3]);
+        }
+        return t;
+    }
+
+    point3 apply_point(const point3& p) const {
+        return point3(row(0, p) + m[0][3], row(1, p) + m[1][3], row(2, p) + m[2][3]);
+    }
+
+    vec3 apply_vector(const vec3& v) const {
+        return vec3(row(0, v), row(1, v), row(2, v));
+    }
+
+    vec3 apply_transposed(const vec3& v) const {
+        // The transposed linear part times v. With the inverse transform this maps normals.
+        return vec3(m[0][0]*v[0] + m[1][0]*v[1] + m[2][0]*v[2],
+                    m[0][1]*v[0] + m[1][1]*v[1] + m[2][1]*v[2],
+                    m[0][2]*v[0] + m[1][2]*v[1] + m[2][2]*v[2]);
+    }
+
+    ray apply(const ray& r) const {
+        // The direction keeps its scale, so distances along the ray are the same in both spaces.
+        return ray(apply_point(r.origin()), apply_vector(r.direction()), r.time());
+    }
+
+    aabb apply(const aabb& box) const {
+        // The box around the eight transformed corners of box. Infinite corners would mix into
+        // NaNs, so a box reaching infinity maps to the whole space.
+        for (int axis = 0; axis < 3; axis++) {
+            const auto& extent = box.axis_interval(axis);
+            if (std::isinf(extent.min) || std::isinf(extent.max))
+                return aabb::universe;
+        }
+
+        interval axes[3] = {interval::empty, interval::empty, interval::empty};
+        for (int corner = 0; corner < 8; corner++) {
+            point3 p(corner & 1 ? box.x.max : box.x.min,
+                     corner & 2 ? box.y.max : box.y.min,
+                     corner & 4 ? box.z.max : box.z.min);
+            auto q = apply_point(p);
+            for (int axis = 0; axis < 3; axis++)
+                axes[axis] = interval(std::fmin(axes[axis].min, q[axis]), std::fmax(axes[axis].max, q[axis]));
+        }
+        return aabb(axes[0], axes[1], axes[2]);
+    }
+
+  private:
+    real m[3][4];
+
+    real row(int i, const vec3& v) const { return m[i][0]*v[0] + m[i][1]*v[1] + m[i][2]*v[2]; }
+};
+
+#endif
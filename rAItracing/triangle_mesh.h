@@ -0,0 +1,225 @@
+//
+//  triangle_mesh.h
+//  rAItracing
+//
+
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "hittable.h"
+#include "linear_bvh.h"
+#include "material_table.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+struct texture_coord {
+    real u = 0;
+    real v = 0;
+};
+
+class triangle_mesh : public hittable {
+  // Triangles sharing one material, stored as vertex buffers and a 32-bit index buffer rather
+  // than one object per triangle, with a BVH of its own over the triangles. The index buffer is
+  // kept in the BVH's leaf order, so a leaf's triangles are a contiguous run of it and the tree
+  // needs no separate index list. Normals and texture coordinates are optional and per vertex;
+  // without normals the face normal is used, and without texture coordinates u and v are the
+  // barycentric coordinates of the hit.
+  public:
+    triangle_mesh(
+        std::vector<point3> positions, std::vector<uint32_t> indices, shared_ptr<material> mat,
+        std::vector<vec3> normals = {}, std::vector<texture_coord> uvs = {},
+        const bvh_build_options& options = {}
+    ) : positions(std::move(positions)), normals(std::move(normals)), uvs(std::move(uvs)),
+        mat(mat), material_id(global_materials().add(mat))
+    {
+        auto vertex_count = this->positions.size();
+        if (!this->normals.empty() && this->normals.size() != vertex_count) {
+            std::cerr << "triangle_mesh: " << this->normals.size() << " normals for " << vertex_count
+                      << " vertices, using face normals\n";
+            this->normals.clear();
+        }
+        if (!this->uvs.empty() && this->uvs.size() != vertex_count) {
+            std::cerr << "triangle_mesh: " << this->uvs.size() << " texture coordinates for "
+                      << vertex_count << " vertices, ignoring them\n";
+            this->uvs.clear();
+        }
+
+        // Keep only complete triangles whose vertices all exist.
+        size_t dropped = 0;
+        std::vector<uint32_t> valid;
+        valid.reserve(indices.size() - indices.size() % 3);
+        for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+            if (indices[i] >= vertex_count || indices[i+1] >= vertex_count || indices[i+2] >= vertex_count) {
+                dropped++;
+                continue;
+            }
+            valid.insert(valid.end(), {indices[i], indices[i+1], indices[i+2]});
+        }
+        if (dropped > 0 || indices.size() % 3 != 0)
+            std::cerr << "triangle_mesh: dropped " << dropped << " triangles with missing vertices and "
+                      << indices.size() % 3 << " trailing indices\n";
+
+        auto tree = linear_bvh_builder(options).build(valid.size() / 3,
+            [&](size_t k) { return triangle_box(valid.data() + 3*k); },
+            [&](size_t k, const aabb& region) {
+                const uint32_t* tri = valid.data() + 3*k;
+                point3 corners[3] = {this->positions[tri[0]], this->positions[tri[1]], this->positions[tri[2]]};
+                return clip_to_box(clip_polygon_bounds(corners, 3, region), region);
+            });
+        nodes = std::move(tree.nodes);
+
+        this->indices.reserve(valid.size());
+        for (auto k : tree.order)
+            this->indices.insert(this->indices.end(), valid.begin() + 3*k, valid.begin() + 3*k + 3);
+
+        for (size_t k = 0; k < triangle_count(); k++)
+            bbox = aabb(bbox, triangle_box(this->indices.data() + 3*k));
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        watertight_ray wr(r);
+        return linear_bvh_traverse(nodes, r, ray_t, rec,
+            [&](const linear_bvh_node& node, interval leaf_t, hit_record& leaf_rec) {
+                bool hit_anything = false;
+                for (uint32_t k = node.offset; k < node.offset + node.primitive_count; k++) {
+                    if (intersect(wr, k, leaf_t, leaf_rec)) {
+                        hit_anything = true;
+                        leaf_t.max = leaf_rec.t;
+                    }
+                }
+                return hit_anything;
+            });
+    }
+
+    void finalize_hit(const ray& r, hit_record& rec) const override {
+        // hit() left the triangle in rec.primitive and the barycentric weights of its second
+        // and third vertices in rec.u and rec.v.
+        const uint32_t* tri = indices.data() + 3*size_t(rec.primitive);
+        auto b1 = rec.u;
+        auto b2 = rec.v;
+        auto b0 = 1 - b1 - b2;
+
+        rec.p = r.at(rec.t);
+
+        const auto& p0 = positions[tri[0]];
+        vec3 outward_normal = unit_vector(cross(positions[tri[1]] - p0, positions[tri[2]] - p0));
+        if (!normals.empty()) {
+            auto n = b0*normals[tri[0]] + b1*normals[tri[1]] + b2*normals[tri[2]];
+            if (n.length_squared() > 0)
+                outward_normal = unit_vector(n);
+        }
+        rec.set_face_normal(r, outward_normal);
+
+        if (!uvs.empty()) {
+            rec.u = b0*uvs[tri[0]].u + b1*uvs[tri[1]].u + b2*uvs[tri[2]].u;
+            rec.v = b0*uvs[tri[0]].v + b1*uvs[tri[1]].v + b2*uvs[tri[2]].v;
+        }
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    size_t triangle_count() const { return indices.size() / 3; }
+    size_t vertex_count() const { return positions.size(); }
+
+    size_t memory_bytes() const {
+        // Heap memory held by the buffers and the tree.
+        return positions.capacity() * sizeof(point3) + normals.capacity() * sizeof(vec3)
+             + uvs.capacity() * sizeof(texture_coord) + indices.capacity() * sizeof(uint32_t)
+             + nodes.capacity() * sizeof(linear_bvh_node);
+    }
+
+  private:
+    std::vector<point3> positions;
+    std::vector<vec3> normals;
+    std::vector<texture_coord> uvs;
+    std::vector<uint32_t> indices;  // Three per triangle, in the BVH's leaf order
+    std::vector<linear_bvh_node> nodes;
+    shared_ptr<material> mat;
+    uint32_t material_id;
+    aabb bbox;
+
+    struct watertight_ray {
+        // Per-ray setup of the watertight ray/triangle test ("Watertight Ray/Triangle
+        // Intersection", Woop, Benthin and Wald 2013): the ray is sheared onto the +z axis, so
+        // every triangle is tested by 2D edge functions that agree exactly along shared edges.
+        point3 origin;
+        int kx, ky, kz;
+        real sx, sy, sz;
+
+        explicit watertight_ray(const ray& r) : origin(r.origin()) {
+            const auto& dir = r.direction();
+            auto ax = std::fabs(dir.x()), ay = std::fabs(dir.y()), az = std::fabs(dir.z());
+            kz = (ax > ay) ? (ax > az ? 0 : 2) : (ay > az ? 1 : 2);
+            kx = (kz + 1) % 3;
+            ky = (kx + 1) % 3;
+
+            // Keep the winding of the triangles when the shear flips the ray.
+            if (r.dir_is_neg(kz))
+                std::swap(kx, ky);
+
+            sz = r.inverse_direction()[kz];
+            sx = dir[kx] * sz;
+            sy = dir[ky] * sz;
+        }
+    };
+
+    aabb triangle_box(const uint32_t* tri) const {
+        interval axes[3];
+        for (int axis = 0; axis < 3; axis++) {
+            auto a = positions[tri[0]][axis], b = positions[tri[1]][axis], c = positions[tri[2]][axis];
+            axes[axis] = interval(std::min({a, b, c}), std::max({a, b, c}));
+        }
+        return aabb(axes[0], axes[1], axes[2]);
+    }
+
+    bool intersect(const watertight_ray& wr, uint32_t k, const interval& ray_t, hit_record& rec) const {
+        const uint32_t* tri = indices.data() + 3*size_t(k);
+        vec3 a = positions[tri[0]] - wr.origin;
+        vec3 b = positions[tri[1]] - wr.origin;
+        vec3 c = positions[tri[2]] - wr.origin;
+
+        real ax = a[wr.kx] - wr.sx*a[wr.kz], ay = a[wr.ky] - wr.sy*a[wr.kz];
+        real bx = b[wr.kx] - wr.sx*b[wr.kz], by = b[wr.ky] - wr.sy*b[wr.kz];
+        real cx = c[wr.kx] - wr.sx*c[wr.kz], cy = c[wr.ky] - wr.sy*c[wr.kz];
+
+        // Scaled barycentric coordinates of the hit, from the edge functions.
+        real u = cx*by - cy*bx;
+        real v = ax*cy - ay*cx;
+        real w = bx*ay - by*ax;
+
+        // An edge function of exactly zero is ambiguous in single precision; redo it in double.
+        if constexpr (std::is_same_v<real, float>) {
+            if (u == 0 || v == 0 || w == 0) {
+                u = real(double(cx)*double(by) - double(cy)*double(bx));
+                v = real(double(ax)*double(cy) - double(ay)*double(cx));
+                w = real(double(bx)*double(ay) - double(by)*double(ax));
+            }
+        }
+
+        // Mixed signs put the ray outside the triangle; both faces are hit.
+        if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0))
+            return false;
+
+        auto det = u + v + w;
+        if (det == 0)
+            return false;
+
+        auto t_scaled = wr.sz * (u*a[wr.kz] + v*b[wr.kz] + w*c[wr.kz]);
+        auto t = t_scaled / det;
+        if (!ray_t.surrounds(t))
+            return false;
+
+        rec.t = t;
+        rec.object = this;
+        rec.material_id = material_id;
+        rec.primitive = k;
+        rec.u = v / det;
+        rec.v = w / det;
+        return true;
+    }
+};
+
+#endif
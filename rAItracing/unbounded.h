@@ -0,0 +1,89 @@
+//
+//  unbounded.h
+//  rAItracing
+//
+
+#ifndef UNBOUNDED_H
+#define UNBOUNDED_H
+
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <cmath>
+
+inline bool is_unbounded(const aabb& box) {
+    // Whether the box reaches infinity along some axis, as the box of an infinite plane does.
+    for (int axis = 0; axis < 3; axis++) {
+        const auto& extent = box.axis_interval(axis);
+        if (std::isinf(extent.min) || std::isinf(extent.max))
+            return true;
+    }
+    return false;
+}
+
+struct unbounded_split {
+    hittable_list bounded;    // Objects an acceleration structure can hold
+    hittable_list unbounded;  // Objects with infinite bounds, tested on their own
+};
+
+inline unbounded_split split_unbounded(const hittable_list& world) {
+    // An infinite box would swallow the root of a BVH and overlap every node below it, so
+    // objects like planes are set apart before a BVH is built over the rest.
+    unbounded_split split;
+    for (const auto& object : world.objects) {
+        if (is_unbounded(object->bounding_box()))
+            split.unbounded.add(object);
+        else
+            split.bounded.add(object);
+    }
+    return split;
+}
+
+class with_unbounded : public hittable {
+  // An acceleration structure over a world's bounded objects, together with the few unbounded
+  // objects it was built without. The unbounded objects are tested first, one by one, so
+  // that a close hit on a ground plane already limits the traversal.
+  public:
+    with_unbounded(shared_ptr<hittable> accelerator, const hittable_list& unbounded)
+      : accelerator(accelerator), unbounded(unbounded.objects) {}
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        bool hit_anything = hit_unbounded(r, ray_t, rec);
+        if (accelerator->hit(r, ray_t, rec))
+            hit_anything = true;
+        return hit_anything;
+    }
+
+    void hit_packet(
+        const ray* rays, int count, interval ray_t, hit_record* recs, bool* hits
+    ) const override {
+        // The packet keeps a common interval through the accelerator, so here the unbounded
+        // objects come second, each ray limited by its own hit.
+        accelerator->hit_packet(rays, count, ray_t, recs, hits);
+        for (int k = 0; k < count; k++) {
+            interval ray_k(ray_t.min, hits[k] ? recs[k].t : ray_t.max);
+            if (hit_unbounded(rays[k], ray_k, recs[k]))
+                hits[k] = true;
+        }
+    }
+
+    aabb bounding_box() const override { return aabb::universe; }
+
+  private:
+    shared_ptr<hittable> accelerator;
+    std::vector<shared_ptr<hittable>> unbounded;
+
+    bool hit_unbounded(const ray& r, interval& ray_t, hit_record& rec) const {
+        // Tests every unbounded object and narrows ray_t to the closest hit.
+        bool hit_anything = false;
+        for (const auto& object : unbounded) {
+            if (hit_fresh(*object, r, ray_t, rec)) {
+                hit_anything = true;
+                ray_t.max = rec.t;
+            }
+        }
+        return hit_anything;
+    }
+};
+
+#endif
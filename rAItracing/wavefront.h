@@ -0,0 +1,50 @@
+//
+//  wavefront.h
+//  rAItracing
+//
+
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "constants.h"
+#include "hittable.h"
+
+#include <cstdint>
+#include <vector>
+
+const size_t wavefront_batch_size = 4096;  // Most paths a wavefront batch keeps in flight
+
+struct wavefront_paths {
+    // State of a batch of paths, one array per field and indexed by path, so each stage only
+    // streams through the fields it touches. The active queue lists the paths still bouncing;
+    // each stage walks it in order and the shade stage compacts the survivors into next.
+    //
+    // Rays and hit records stay whole structs: hit(), hit_packet() and scatter() take them by
+    // reference, and the packet traversal reads a contiguous run of rays. Splitting them into
+    // per-component arrays would mean gathering and scattering both around every call.
+
+    std::vector<ray>        rays;
+    std::vector<color>      throughput;  // Product of the attenuations along the path so far
+    std::vector<color>      radiance;    // Light gathered by the path so far
+    std::vector<pcg32>      generators;  // Each path's own random sequence
+    std::vector<hit_record> recs;
+    std::vector<uint8_t>    hits;
+    std::vector<uint32_t>   active;
+    std::vector<uint32_t>   next;
+
+    void reset(size_t count) {
+        rays.resize(count);
+        throughput.assign(count, color(1,1,1));
+        radiance.assign(count, color(0,0,0));
+        generators.resize(count);
+        recs.resize(count);
+        hits.assign(count, 0);
+
+        active.clear();
+        next.clear();
+        for (size_t k = 0; k < count; k++)
+            active.push_back(uint32_t(k));
+    }
+};
+
+#endif
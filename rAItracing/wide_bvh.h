@@ -0,0 +1,219 @@
+//
+//  wide_bvh.h
+//  rAItracing
+//
+
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "bvh_build.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+#include "simd_aabb.h"
+
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+template <int N>
+struct wide_bvh_node {
+    // Up to N children whose bounds are tested together by one SIMD slab test.
+
+    wide_aabb<N> bounds;
+    uint32_t child[N];      // Interior child: node index. Leaf child: index of its first
+                            // primitive, or of its sphere pack.
+    uint16_t leaf_size[N];  // Primitive count of a leaf child, 0 for interior children
+    uint8_t  packed[N];     // 1 for a leaf child stored as a sphere pack
+    int      child_count = 0;
+};
+
+template <int N>
+class wide_bvh : public hittable {
+  // A BVH with N children per node (BVH4/BVH8), made by collapsing the binary linear_bvh: each
+  // wide node pulls up the largest interior descendants of a binary node until it has N
+  // children. Traversal tests all children of a node at once and visits the ones the ray hits
+  // nearest first.
+  public:
+    wide_bvh(const hittable_list& list, const bvh_build_options& options = {}) {
+        linear_bvh binary(list, options);
+        const auto& binary_nodes = binary.flat_nodes();
+
+        primitives = binary.leaf_primitives();
+        packs = binary.sphere_packs();
+
+        nodes.reserve(binary_nodes.size() / (N - 1) + 1);
+        if (!binary_nodes.empty())
+            collapse(binary_nodes, 0);
+
+        bbox = list.bounding_box();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (nodes.empty())
+            return false;
+
+        slab_ray slab(r);
+
+        struct stack_entry {
+            uint32_t child;
+            uint16_t leaf_size;
+            uint8_t  packed;
+            float    t_enter;
+        };
+        stack_entry stack[stack_size];
+        int stack_count = 0;
+
+        bool hit_anything = false;
+        auto t_min = round_down_to_float(ray_t.min);
+        stack_entry current = {0, 0, 0, t_min};
+
+        while (true) {
+            if (current.packed) {
+                if (packs[current.child].hit(r, ray_t, rec)) {
+                    hit_anything = true;
+                    ray_t.max = rec.t;
+                }
+            } else if (current.leaf_size > 0) {
+                for (uint32_t k = 0; k < current.leaf_size; k++) {
+                    if (primitives->hit(current.child + k, r, ray_t, rec)) {
+                        hit_anything = true;
+                        ray_t.max = rec.t;
+                    }
+                }
+            } else {
+                const auto& node = nodes[current.child];
+                float t_enter[N];
+                int mask = node.bounds.hit(slab, t_min, round_up_to_float(ray_t.max), t_enter);
+
+                if (mask != 0) {
+                    // Sort the children that were hit farthest first, keep the nearest one as the
+                    // next node to visit and defer the rest.
+                    stack_entry hits[N];
+                    int hit_count = 0;
+                    while (mask) {
+                        int i = std::countr_zero(unsigned(mask));
+                        mask &= mask - 1;
+
+                        stack_entry e = {node.child[i], node.leaf_size[i], node.packed[i], t_enter[i]};
+                        int k = hit_count++;
+                        while (k > 0 && hits[k-1].t_enter < e.t_enter) {
+                            hits[k] = hits[k-1];
+                            k--;
+                        }
+                        hits[k] = e;
+                    }
+
+                    for (int k = 0; k < hit_count - 1; k++)
+                        stack[stack_count++] = hits[k];
+                    current = hits[hit_count - 1];
+                    continue;
+                }
+            }
+
+            // Pop the next deferred child, skipping any that start beyond the closest hit.
+            while (stack_count > 0 && stack[stack_count - 1].t_enter > ray_t.max * slab_far_scale)
+                stack_count--;
+            if (stack_count == 0)
+                break;
+            current = stack[--stack_count];
+        }
+
+        return hit_anything;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    size_t node_count() const { return nodes.size(); }
+
+    bvh_stats stats() const {
+        bvh_stats result;
+        if (!nodes.empty()) {
+            accumulate_stats(result, 0, bbox, 0);
+            result.finish(bbox);
+        }
+        return result;
+    }
+
+  private:
+    // Each visited node replaces its stack entry with at most N children.
+    static constexpr int stack_size = (N - 1) * linear_bvh::max_depth + 1;
+
+    std::vector<wide_bvh_node<N>> nodes;
+    shared_ptr<const primitive_arrays> primitives;  // Primitives in leaf order, by type
+    std::vector<sphere_pack> packs;  // The binary tree's sphere packs, same indices
+    aabb bbox;
+
+    uint32_t collapse(const std::vector<linear_bvh_node>& binary_nodes, uint32_t binary_index) {
+        auto node_index = uint32_t(nodes.size());
+        nodes.emplace_back();
+
+        // Open the interior child with the largest surface area until there are N children. A
+        // root that is itself a leaf simply becomes the only child.
+        std::vector<uint32_t> children;
+        const auto& root = binary_nodes[binary_index];
+        if (root.is_leaf()) {
+            children.push_back(binary_index);
+        } else {
+            children.push_back(binary_index + 1);
+            children.push_back(root.offset);
+        }
+
+        while (int(children.size()) < N) {
+            int widest = -1;
+            double widest_area = -1;
+            for (int k = 0; k < int(children.size()); k++) {
+                const auto& child = binary_nodes[children[k]];
+                if (child.is_leaf())
+                    continue;
+                auto area = child.bounds().surface_area();
+                if (area > widest_area) {
+                    widest = k;
+                    widest_area = area;
+                }
+            }
+            if (widest < 0)
+                break;
+
+            auto opened = children[widest];
+            children[widest] = opened + 1;
+            children.push_back(binary_nodes[opened].offset);
+        }
+
+        wide_bvh_node<N> node;
+        node.child_count = int(children.size());
+        for (int k = 0; k < node.child_count; k++) {
+            const auto& child = binary_nodes[children[k]];
+            node.bounds.set(k, child.bounds());
+            if (child.is_leaf()) {
+                node.child[k] = child.offset;
+                node.leaf_size[k] = child.primitive_count;
+                node.packed[k] = child.packed;
+            } else {
+                node.child[k] = collapse(binary_nodes, children[k]);
+                node.leaf_size[k] = 0;
+                node.packed[k] = 0;
+            }
+        }
+
+        nodes[node_index] = node;
+        return node_index;
+    }
+
+    void accumulate_stats(bvh_stats& stats, uint32_t index, const aabb& box, int depth) const {
+        stats.add_interior(box, depth);
+
+        const auto& node = nodes[index];
+        for (int k = 0; k < node.child_count; k++) {
+            if (node.leaf_size[k] > 0)
+                stats.add_leaf(node.bounds.get(k), node.leaf_size[k], depth + 1);
+            else
+                accumulate_stats(stats, node.child[k], node.bounds.get(k), depth + 1);
+        }
+    }
+};
+
+using bvh4 = wide_bvh<4>;
+using bvh8 = wide_bvh<8>;
+
+#endif